@@ -0,0 +1,353 @@
+ /*
+    bench.c - synthesis and encoding benchmarks for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <FLAC/stream_encoder.h>
+
+#include "encode.h"
+#include "synth.h"
+#include "version.h"
+
+#define DEFAULT_CORPUS_LEN (4096)
+
+/* only the start of each corpus is kept for the conversion and encoding stages */
+#define CAPTURE_SAMPLES (1 << 22)
+
+struct setting {
+	int wpm;
+	int fwpm;
+
+	/* a fist, to compare with the plain keying at the same speed */
+	int weight;
+	int jitter;
+	int drift;
+};
+
+static const struct setting settings[] = {
+	{ 18, 18, DEFAULT_WEIGHT, 0, 0 },
+	{ 18, 18, 55, 10, 5 },
+	{ 25, 10, DEFAULT_WEIGHT, 0, 0 },
+	{ 40, 40, DEFAULT_WEIGHT, 0, 0 },
+};
+
+/* encoder profiles, from cheapest to the default */
+struct profile {
+	const char *name;
+	int compression_level;
+	int verify;
+};
+
+static const struct profile profiles[] = {
+	{ "fast", FAST_COMPRESSION_LEVEL, FAST_VERIFY },
+	{ "l5", 5, 0 },
+	{ "l8", DEFAULT_COMPRESSION_LEVEL, 0 },
+	{ "default", DEFAULT_COMPRESSION_LEVEL, DEFAULT_VERIFY },
+};
+
+struct capture {
+	int16_t *samples;
+	int32_t *pcm;
+	size_t len;
+
+	/* FNV-1a of every sample, not only the ones kept */
+	uint64_t digest;
+};
+
+static size_t encoded_bytes = 0;
+
+/* the slowest synthesis seen, in samples per second */
+static double slowest = 0;
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* deterministic so every run measures the same text */
+static unsigned long seed = 1;
+
+static unsigned long next_random(void) {
+	seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (seed >> 33) & 0x7fffffff;
+}
+
+static void random_text(char *text, size_t len) {
+	const char *chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.,?=";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		text[i] = next_random() % 6 == 0 ? ' ' : chars[next_random() % strlen(chars)];
+	}
+}
+
+static void prose_text(char *text, size_t len) {
+	const char *prose =
+		"It was the best of times, it was the worst of times, it was the age "
+		"of wisdom, it was the age of foolishness, it was the epoch of belief, "
+		"it was the epoch of incredulity, it was the season of Light, it was "
+		"the season of Darkness, it was the spring of hope, it was the winter "
+		"of despair. ";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		text[i] = prose[i % strlen(prose)];
+	}
+}
+
+static void number_groups(char *text, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		text[i] = i % 6 == 5 ? ' ' : '0' + next_random() % 10;
+	}
+}
+
+static void space_runs(char *text, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		text[i] = i % 32 < 4 ? "CQDE"[i % 4] : ' ';
+	}
+}
+
+struct corpus {
+	const char *name;
+	void (*make)(char *text, size_t len);
+};
+
+static const struct corpus corpora[] = {
+	{ "random", random_text },
+	{ "prose", prose_text },
+	{ "numbers", number_groups },
+	{ "spaces", space_runs },
+};
+
+static void discard(struct output *out) {
+	(void) out;
+}
+
+static void capture(struct output *out) {
+	struct capture *cap = (struct capture *) out->data;
+	size_t n = out->ring_len;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		cap->digest = (cap->digest ^ (uint16_t) out->pcm[i]) * 0x100000001b3ULL;
+	}
+
+	n = n < CAPTURE_SAMPLES - cap->len ? n : CAPTURE_SAMPLES - cap->len;
+	for (i = 0; i < n; i++) {
+		cap->samples[cap->len + i] = out->pcm[i];
+	}
+	cap->len += n;
+}
+
+static FLAC__StreamEncoderWriteStatus count_bytes(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, uint32_t samples, uint32_t current_frame, void *client_data) {
+	(void) encoder;
+	(void) buffer;
+	(void) samples;
+	(void) current_frame;
+	(void) client_data;
+
+	encoded_bytes += bytes;
+	return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+static void report(const char *stage, size_t samples, double elapsed) {
+	printf("  %-6s %9.1f Msamples/s %9.1f MB/s", stage,
+		samples / elapsed / 1e6, samples * (DEFAULT_BPS / 8) / elapsed / 1e6);
+}
+
+static void bench(const struct corpus *corpus, const struct setting *setting, const unsigned char *text, size_t len, struct capture *cap) {
+
+	FLAC__StreamEncoder *encoder = NULL;
+	struct synth synth;
+	struct output *out = NULL;
+	double start = 0;
+	double elapsed = 0;
+	size_t total = 0;
+	size_t i = 0;
+	size_t n = 0;
+	size_t p = 0;
+
+	out = (struct output *) malloc(sizeof(struct output));
+	if (out == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+
+	default_synth(&synth);
+	synth.wpm = setting->wpm;
+	synth.fwpm = setting->fwpm;
+	synth.fist.weight = setting->weight;
+	synth.fist.jitter = setting->jitter;
+	synth.fist.drift = setting->drift;
+
+	init_space(&synth);
+	if (init_tone(&synth) == -1 || init_glyphs(&synth, 1) == -1) {
+		fprintf(stderr, "Failed to initialize tones\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-8s %3d/%-3d %-4s", corpus->name, setting->wpm, setting->fwpm, is_humanized(&synth) ? "fist" : "");
+
+	/* synthesis: glyphs and silence into the output ring, nothing downstream */
+	init_output(out, &synth, discard, NULL);
+	start = now();
+	write_text(out, text, len);
+	flush_output(out);
+	elapsed = now() - start;
+	total = out->total_samples;
+	report("synth", total, elapsed);
+	slowest = slowest == 0 || total / elapsed < slowest ? total / elapsed : slowest;
+
+	/* conversion: 16-bit samples to the encoder's 32-bit input */
+	cap->len = 0;
+	cap->digest = 0xcbf29ce484222325ULL;
+	init_output(out, &synth, capture, cap);
+	write_text(out, text, len);
+	flush_output(out);
+
+	start = now();
+	widen_samples(cap->pcm, cap->samples, cap->len, synth.bps);
+	elapsed = now() - start;
+	report("pcm", cap->len, elapsed);
+
+	/* what was rendered, to compare from one build to the next */
+	printf("  %10lu samples %016llx\n", (unsigned long) total, (unsigned long long) cap->digest);
+
+	/* encoding: libFLAC with each profile, output counted and dropped */
+	encoder = FLAC__stream_encoder_new();
+	if (encoder == NULL) {
+		fprintf(stderr, "ERROR: allocating encoder\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+		compression_level = profiles[p].compression_level;
+		verify = profiles[p].verify;
+
+		if (!setup_encoder(encoder, &synth, cap->len) ||
+				FLAC__stream_encoder_init_stream(encoder, count_bytes, NULL, NULL, NULL, NULL) != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+			fprintf(stderr, "ERROR: initializing encoder\n");
+			exit(EXIT_FAILURE);
+		}
+
+		encoded_bytes = 0;
+		start = now();
+		for (i = 0; i < cap->len; i += n) {
+			n = cap->len - i < RINGSIZE ? cap->len - i : RINGSIZE;
+			FLAC__stream_encoder_process_interleaved(encoder, cap->pcm + i, n);
+		}
+		FLAC__stream_encoder_finish(encoder);
+		elapsed = now() - start;
+
+		printf("%21s", profiles[p].name);
+		report("flac", cap->len, elapsed);
+		printf("  ratio %5.1f\n", encoded_bytes == 0 ? 0.0 : (double) cap->len * (synth.bps / 8) / encoded_bytes);
+	}
+
+	FLAC__stream_encoder_delete(encoder);
+
+	exit_glyphs(&synth);
+	exit_tone(&synth);
+	exit_space(&synth);
+
+	free(out);
+}
+
+int main(int argc, char *argv[]) {
+
+	struct capture cap;
+	struct rusage usage;
+	unsigned char *text = NULL;
+	size_t len = DEFAULT_CORPUS_LEN;
+	double min_rate = 0;
+	long max_rss = 0;
+	int failed = 0;
+	size_t c, s;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "hm:n:s:")) != -1) {
+		switch (ch) {
+			case 'n':
+				len = strtoul(optarg, NULL, 10);
+				len = len == 0 ? DEFAULT_CORPUS_LEN : len;
+				break;
+			case 'm':
+				max_rss = strtol(optarg, NULL, 10);
+				max_rss = max_rss < 0 ? 0 : max_rss;
+				break;
+			case 's':
+				min_rate = strtod(optarg, NULL);
+				min_rate = min_rate < 0 ? 0 : min_rate;
+				break;
+			default:
+				fprintf(stderr, "usage: text-to-morse-bench [-n CHARS] [-s MSAMPLES] [-m KIB]\n");
+				exit(ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	text = (unsigned char *) malloc(len);
+	cap.samples = (int16_t *) malloc(CAPTURE_SAMPLES * sizeof(int16_t));
+	cap.pcm = (int32_t *) malloc(CAPTURE_SAMPLES * sizeof(int32_t));
+	if (text == NULL || cap.samples == NULL || cap.pcm == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("text-to-morse v%s benchmarks, %lu characters per corpus\n\n", TEXT_TO_CW_VERSION_STRING, (unsigned long) len);
+
+	for (c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+		seed = 1;
+		corpora[c].make((char *) text, len);
+		for (s = 0; s < sizeof(settings) / sizeof(settings[0]); s++) {
+			bench(&corpora[c], &settings[s], text, len, &cap);
+		}
+	}
+
+	getrusage(RUSAGE_SELF, &usage);
+	printf("\npeak RSS %ld KiB\n", usage.ru_maxrss);
+
+	/* limits to fail on, for a build to catch a regression with */
+	if (min_rate > 0 && slowest / 1e6 < min_rate) {
+		fprintf(stderr, "synthesis at %.1f Msamples/s is slower than %.1f\n", slowest / 1e6, min_rate);
+		failed = 1;
+	}
+	if (max_rss > 0 && usage.ru_maxrss > max_rss) {
+		fprintf(stderr, "peak RSS of %ld KiB is over %ld\n", usage.ru_maxrss, max_rss);
+		failed = 1;
+	}
+
+	free(text);
+	free(cap.samples);
+	free(cap.pcm);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,60 @@
+ /*
+    arena.h - bump allocation with a single teardown for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TEXT_TO_CW_ARENA_H
+#define TEXT_TO_CW_ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* every allocation starts on a cache line, which is more than SIMD loads need */
+#define ARENA_ALIGN (64)
+
+/* the first chunk; each one after is as big as all those before it put together */
+#define ARENA_MIN_CHUNK (64 * 1024)
+
+/* chunks this big are mapped directly and offered huge pages */
+#define ARENA_HUGE_CHUNK (2 * 1024 * 1024)
+
+struct arena_chunk;
+
+/*
+ * memory that's handed out in pieces and only given back all at once,
+ * so a lot of small allocations cost a few system ones. safe to use
+ * from several threads at once.
+ */
+struct arena {
+	pthread_mutex_t lock;
+	struct arena_chunk *chunks;
+	size_t total;
+};
+
+void init_arena(struct arena *arena);
+
+/* size bytes aligned to ARENA_ALIGN, NULL when out of memory */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/* a copy of s in the arena */
+char *arena_strdup(struct arena *arena, const char *s);
+
+/* everything allocated from arena is gone */
+void free_arena(struct arena *arena);
+
+#endif
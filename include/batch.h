@@ -0,0 +1,35 @@
+ /*
+    batch.h - batch conversion for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+
+#ifndef TEXT_TO_CW_BATCH_H
+#define TEXT_TO_CW_BATCH_H
+
+#include "sink.h"
+
+/*
+ * convert every file named in a manifest (argc == 1) or found in an input
+ * directory (argc == 2, written to the output directory) on jobs worker
+ * threads. outputs are written in the format their extension names, or
+ * type when it isn't one. returns -1 if any file failed.
+ */
+int encode_batch(struct synth *synth, int argc, char *argv[], const struct sink_type *type, int jobs);
+
+#endif
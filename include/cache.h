@@ -0,0 +1,89 @@
+ /*
+    cache.h - rendered audio kept by what it was rendered from
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TEXT_TO_CW_CACHE_H
+#define TEXT_TO_CW_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sink.h"
+#include "synth.h"
+
+/* megabytes, for --cache */
+#define MAX_CACHE_MB (65536)
+
+/*
+ * everything the audio depends on. the encoder's settings aren't here:
+ * they're fixed for the life of the process, and so is a cache.
+ */
+struct cache_key {
+	const struct sink_type *type;
+	int wpm;
+	int fwpm;
+	double frequency;
+	double sample_rate;
+	int bps;
+	int phase_continuous;
+	struct fist fist;
+	const unsigned char *text;
+	size_t text_len;
+	uint64_t hash;
+};
+
+/* a cached answer; data and len don't change while a reference is held */
+struct cache_entry {
+	const unsigned char *data;
+	size_t len;
+};
+
+struct cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	size_t entries;
+	size_t bytes;
+};
+
+struct cache;
+
+/* keeps up to capacity bytes of audio and keys, least recently used out first; NULL on failure */
+struct cache *new_cache(size_t capacity);
+void delete_cache(struct cache *cache);
+
+/* fill in the key from a synth's parameters and the text, which must outlive the key, and hash it */
+void make_cache_key(struct cache_key *key, const struct synth *synth, const struct sink_type *type, const unsigned char *text, size_t text_len);
+
+/* a reference to the audio for key, or NULL (and a miss) if there isn't any */
+const struct cache_entry *cache_get(struct cache *cache, const struct cache_key *key);
+
+/*
+ * hand the malloc()ed audio for key to the cache and get a reference to
+ * it back. if key is already there the existing entry is returned and
+ * data is freed. NULL, with data untouched, if it's too big or out of memory.
+ */
+const struct cache_entry *cache_put(struct cache *cache, const struct cache_key *key, unsigned char *data, size_t len);
+
+/* done with a reference from cache_get() or cache_put() */
+void cache_release(struct cache *cache, const struct cache_entry *entry);
+
+void cache_get_stats(struct cache *cache, struct cache_stats *stats);
+
+#endif
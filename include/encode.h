@@ -0,0 +1,74 @@
+ /*
+    encode.h - FLAC encoding for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+
+#ifndef TEXT_TO_CW_ENCODE_H
+#define TEXT_TO_CW_ENCODE_H
+
+#include <stddef.h>
+
+#include <FLAC/stream_encoder.h>
+
+#include "sink.h"
+#include "synth.h"
+
+#define DEFAULT_COMPRESSION_LEVEL (8)
+#define DEFAULT_VERIFY (1)
+
+/* 0 leaves the block size to the compression level */
+#define DEFAULT_BLOCKSIZE (0)
+#define MIN_BLOCKSIZE (16)
+#define MAX_BLOCKSIZE (65535)
+
+/* the --fast profile: no verify pass and the cheapest compression */
+#define FAST_COMPRESSION_LEVEL (0)
+#define FAST_VERIFY (0)
+
+extern int verify;
+extern int compression_level;
+extern unsigned flac_blocksize;
+
+/* a libFLAC apodization specification, NULL for the compression level's */
+extern const char *flac_apodization;
+
+/*
+ * apply the encoder settings shared by every output; expected_samples
+ * is the exact stream length from the measure_text() pre-pass, or 0
+ * when it isn't known.
+ */
+FLAC__bool setup_encoder(FLAC__StreamEncoder *encoder, const struct synth *synth, size_t expected_samples);
+
+/* flush callback for an output whose data is a FLAC__StreamEncoder */
+void encode_output(struct output *out);
+
+/*
+ * start and finish a file with an encoder the caller owns, so one encoder
+ * can be reused for many files; both return -1 on failure. filepath "-" is
+ * standard output, which gets each frame as it's encoded.
+ */
+int open_encoder(struct output *out, struct synth *synth, FLAC__StreamEncoder *encoder, char *filepath, size_t expected_samples);
+int open_encoder_buffer(struct output *out, struct synth *synth, FLAC__StreamEncoder *encoder, struct buffer *buffer, size_t expected_samples);
+int close_encoder(struct output *out);
+
+/* same, with an encoder of its own and exiting on failure */
+void init_encoder(struct output *out, struct synth *synth, char *filepath, size_t expected_samples);
+void finish_encoder(struct output *out);
+
+#endif
@@ -0,0 +1,53 @@
+ /*
+    input.h - input text for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+
+#ifndef TEXT_TO_CW_INPUT_H
+#define TEXT_TO_CW_INPUT_H
+
+#include <stddef.h>
+
+#include "synth.h"
+
+/*
+ * the whole input in memory: regular files are mmap()ed, anything else
+ * (pipes, terminals, ...) is read in large blocks into a buffer. text
+ * that normalize() would change is replaced with a normalized copy.
+ */
+struct text {
+	const unsigned char *bytes;
+	size_t len;
+
+	/* non-zero when bytes is a mapping rather than a malloc()ed buffer */
+	int mapped;
+};
+
+/* path "-" is standard input */
+int open_text(struct text *text, const char *path);
+void close_text(struct text *text);
+
+/*
+ * normalize and synthesize whatever can be read from fd as soon as it
+ * arrives instead of waiting for EOF, for pipes of unknown length;
+ * returns -1 on a read error.
+ */
+int stream_text(struct output *out, int fd);
+
+#endif
@@ -0,0 +1,45 @@
+ /*
+    mix.h - several stations at once for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+
+#ifndef TEXT_TO_CW_MIX_H
+#define TEXT_TO_CW_MIX_H
+
+#include "sink.h"
+#include "synth.h"
+
+#define MAX_VOICES (64)
+
+/* noise is band limited to a receiver's passband */
+#define NOISE_LOW (300)
+#define NOISE_HIGH (2700)
+#define MAX_NOISE (100)
+
+/*
+ * key every voice named in a mix file at once and write their sum to
+ * filepath. each line is an input text and NAME=VALUE fields for that
+ * voice: wpm, fwpm, tone, gain (percent), start (milliseconds), phase,
+ * weight, jitter, drift and seed; anything not given comes from
+ * defaults. noise is the level of band limited noise added, as a
+ * percent of a voice at full gain. returns -1 on failure.
+ */
+int mix_voices(const struct synth *defaults, char *mixfile, const struct sink_type *type, char *filepath, int noise);
+
+#endif
@@ -0,0 +1,43 @@
+ /*
+    morse.h - packed morse code table for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+
+#ifndef TEXT_TO_CW_MORSE_H
+#define TEXT_TO_CW_MORSE_H
+
+#include <stdint.h>
+
+#define MORSE_MAX_ELEMENTS (16)
+
+/*
+ * one character's code: element i is a dah when bit i of code is set
+ * and a dit otherwise. a word space has no elements.
+ */
+struct morse {
+	uint16_t code;
+	uint8_t len;
+	uint8_t dahs;
+	uint8_t space;
+};
+
+/* generated at build time from alphabet.inc */
+extern const struct morse morse_table[256];
+
+#endif
@@ -0,0 +1,62 @@
+ /*
+    normalize.h - input text to the characters morse_table knows
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TEXT_TO_CW_NORMALIZE_H
+#define TEXT_TO_CW_NORMALIZE_H
+
+#include <stddef.h>
+
+/* the longest UTF-8 sequence or prosign that can be cut off at the end of a block */
+#define NORMALIZE_HOLD (8)
+
+/* what normalize() may write for len bytes: nothing grows more than threefold */
+#define NORMALIZE_ROOM(len) (3 * ((len) + NORMALIZE_HOLD))
+
+/*
+ * UTF-8 is decoded and transliterated to plain letters, digits and
+ * punctuation, with bytes that aren't UTF-8 read as Windows-1252.
+ * prosigns like <AR> and <SK> become the single byte morse_table sends
+ * them as, and each run of white space becomes one space. everything
+ * else, ASCII that has no code included, is passed on as it is.
+ *
+ * a stream is done a block at a time, with whatever is cut off at the
+ * end of one block held over until the next.
+ */
+struct normalizer {
+	unsigned char held[NORMALIZE_HOLD];
+	size_t nheld;
+
+	/* whether the last character out was a space */
+	int space;
+};
+
+void init_normalizer(struct normalizer *n);
+
+/*
+ * normalize len bytes of src into dst, which has room for
+ * NORMALIZE_ROOM(len) bytes, and return how many there are. final is
+ * set for the last block, so nothing is held over.
+ */
+size_t normalize(struct normalizer *n, unsigned char *dst, const unsigned char *src, size_t len, int final);
+
+/* whether normalize() would leave text as it is, so it needn't be copied */
+int is_normal(const unsigned char *text, size_t len);
+
+#endif
@@ -0,0 +1,45 @@
+ /*
+    parallel.h - multithreaded encoding for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+
+#ifndef TEXT_TO_CW_PARALLEL_H
+#define TEXT_TO_CW_PARALLEL_H
+
+#include "input.h"
+
+#define MAX_JOBS (256)
+
+/*
+ * synthesize and encode input on a pool of jobs worker threads and stitch
+ * the segments they produce into a single FLAC file at filepath.
+ * filepath "-" streams to standard output, without a seek table or
+ * frame sizes since those are only known at the end.
+ */
+void encode_parallel(struct synth *synth, const struct text *text, char *filepath, int jobs);
+
+/*
+ * the same, but cut into a segment per word, and the encoded frames of
+ * every word are kept in stashpath. words that were already there the
+ * last time, with the same settings, are copied instead of encoded, so
+ * re-rendering an edited text only costs as much as the edit.
+ */
+void encode_incremental(struct synth *synth, const struct text *text, char *filepath, const char *stashpath, int jobs);
+
+#endif
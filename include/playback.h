@@ -0,0 +1,43 @@
+ /*
+    playback.h - real-time output for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TEXT_TO_CW_PLAYBACK_H
+#define TEXT_TO_CW_PLAYBACK_H
+
+#include <stddef.h>
+
+#include "synth.h"
+
+/*
+ * raw signed little endian PCM in the synth's format is written to fd
+ * in small periods, paced against the clock so no more than PLAYBACK_LEAD
+ * samples are ever ahead of real time. pipe it into a player, e.g.
+ * aplay -f S16_LE -r 44100 or pacat --raw --latency-msec=10.
+ */
+#define PLAYBACK_PERIOD (256)
+#define PLAYBACK_LEAD (2 * PLAYBACK_PERIOD)
+
+/* play text, then return once the last sample is written */
+void play_text(struct synth *synth, int fd, const unsigned char *text, size_t len);
+
+/* key each byte read from in as it arrives, with silence in between, until EOF or ^D */
+void play_keys(struct synth *synth, int fd, int in);
+
+#endif
@@ -0,0 +1,56 @@
+ /*
+    progress.h - progress reports on a file descriptor for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TEXT_TO_CW_PROGRESS_H
+#define TEXT_TO_CW_PROGRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "synth.h"
+
+/* at most one report per this many milliseconds, and a last one at exit */
+#define PROGRESS_PERIOD_MS (500)
+
+/*
+ * a report is one line of NAME=VALUE fields, written with a single
+ * write() so lines from a pipe never interleave:
+ *
+ *   synthesized=SAMPLES written=SAMPLES total=SAMPLES frames=N bytes=N
+ *   ratio=BYTES_PER_PCM_BYTE speed=TIMES_REAL_TIME elapsed=SECONDS done=0|1
+ *
+ * total is 0 when the length isn't known up front. there's one output
+ * per process to report on, so it's left out of batch and server modes.
+ */
+void start_progress(int fd, const struct synth *synth);
+
+/* the whole output's length in samples, once it's known */
+void expect_progress(size_t total);
+
+/*
+ * called by the sinks as they go and cheap when there's no --progress:
+ * samples handed over by the synthesizer, samples (frames, bytes) added
+ * to the output, or the encoder's totals so far.
+ */
+void progress_synthesized(uint64_t samples);
+void progress_wrote(uint64_t samples, uint64_t frames, uint64_t bytes);
+void progress_encoded(uint64_t samples, uint64_t frames, uint64_t bytes);
+
+#endif
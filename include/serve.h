@@ -0,0 +1,55 @@
+ /*
+    serve.h - text-to-morse as a long-running server
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+
+#ifndef TEXT_TO_CW_SERVE_H
+#define TEXT_TO_CW_SERVE_H
+
+#include "sink.h"
+#include "synth.h"
+
+/* open connections; past this the server stops accepting until one closes */
+#define SERVE_MAX_CONNECTIONS (1024)
+
+/* longest request header line and text accepted */
+#define SERVE_MAX_HEADER (1024)
+#define SERVE_MAX_TEXT (1024 * 1024)
+
+/*
+ * listen on address, a Unix socket if it has a '/' in it and otherwise
+ * [HOST:]PORT, and answer requests on jobs worker threads until killed.
+ * a request is one line of space separated NAME=VALUE fields, then
+ * length bytes of text:
+ *
+ *     length=5 format=wav wpm=25\nCQ CQ
+ *
+ * length is required. format, wpm, fwpm, tone, rate, bits, phase (1 for
+ * -c), weight, jitter, drift and seed default to defaults and type. the answer is "OK BYTES\n"
+ * and BYTES of audio, or "ERR REASON\n" and the connection is closed.
+ * requests on a connection are answered in order, one at a time; the
+ * next isn't read until the last answer is sent.
+ * with a cache_size, answers are kept by what they were rendered from,
+ * up to cache_size bytes, and repeated requests are sent the same bytes
+ * without rendering; SIGUSR1 logs its hits and misses.
+ * returns -1 if it can't start.
+ */
+int serve(const struct synth *defaults, const struct sink_type *type, const char *address, int jobs, size_t cache_size);
+
+#endif
@@ -0,0 +1,98 @@
+ /*
+    sink.h - output formats for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TEXT_TO_CW_SINK_H
+#define TEXT_TO_CW_SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "synth.h"
+
+/* memory an output can be written to instead of a file */
+struct buffer {
+	unsigned char *data;
+	size_t len;
+	size_t cap;
+};
+
+/* room for len more bytes without growing again, -1 when out of memory */
+int reserve_buffer(struct buffer *buffer, size_t len);
+
+/* add len bytes to the end, -1 when out of memory */
+int append_buffer(struct buffer *buffer, const void *data, size_t len);
+
+/*
+ * an output format. create() makes the state one sink keeps from file to
+ * file (an encoder, a buffer, ...), open() points an output at a new file
+ * with it and close() finishes that file; both return -1 on failure.
+ * filepath "-" is standard output. open_buffer() is open() appending
+ * to buffer instead, which must outlive the close().
+ */
+struct sink_type {
+	const char *name;
+	const char *extension;
+
+	void *(*create)(void);
+	void (*destroy)(void *state);
+
+	int (*open)(struct output *out, struct synth *synth, void *state, char *filepath, size_t expected_samples);
+	int (*open_buffer)(struct output *out, struct synth *synth, void *state, struct buffer *buffer, size_t expected_samples);
+	int (*close)(struct output *out);
+};
+
+struct sink {
+	const struct sink_type *type;
+	void *state;
+
+	/* what's open, so close_sink() can tell --stats how much was written */
+	const char *filepath;
+	struct buffer *buffer;
+	size_t base;
+};
+
+extern const struct sink_type flac_sink;
+extern const struct sink_type wav_sink;
+extern const struct sink_type raw_sink;
+
+/*
+ * pack n ring samples as bps/8 byte little endian words, offset by 128
+ * when offset_binary (8-bit WAV is unsigned); returns the bytes written.
+ */
+size_t pack_samples(unsigned char *dst, const int32_t *src, size_t n, int bps, int offset_binary);
+
+/* by name, NULL if there's no such format */
+const struct sink_type *find_sink_type(const char *name);
+
+/* by the extension of filepath, fallback if it doesn't have a known one */
+const struct sink_type *sink_type_for_path(const char *filepath, const struct sink_type *fallback);
+
+int new_sink(struct sink *sink, const struct sink_type *type);
+void delete_sink(struct sink *sink);
+
+int open_sink(struct sink *sink, struct output *out, struct synth *synth, char *filepath, size_t expected_samples);
+int open_sink_buffer(struct sink *sink, struct output *out, struct synth *synth, struct buffer *buffer, size_t expected_samples);
+int close_sink(struct sink *sink, struct output *out);
+
+/* new_sink() and open_sink(), then close_sink() and delete_sink(), exiting on failure */
+void init_sink(struct sink *sink, const struct sink_type *type, struct output *out, struct synth *synth, char *filepath, size_t expected_samples);
+void finish_sink(struct sink *sink, struct output *out);
+
+#endif
@@ -0,0 +1,105 @@
+ /*
+    stats.h - where the time goes, for --stats
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TEXT_TO_CW_STATS_H
+#define TEXT_TO_CW_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* what --stats asked for */
+#define STATS_OFF (0)
+#define STATS_TEXT (1)
+#define STATS_JSON (2)
+
+/* STATS_OFF until start_stats() */
+extern int stats_format;
+
+/* count from now on and report to stderr at exit, or say it wasn't built in */
+void start_stats(int format);
+
+/* what's been counted so far, in stats_format */
+void report_stats(FILE *out);
+
+/*
+ * the counters are only there when built with -DTTM_STATS=ON; otherwise
+ * every macro below is empty. they're taken once per ring, file or read,
+ * never per sample, and are summed over every thread.
+ */
+#ifdef TTM_STATS
+
+#include <time.h>
+
+enum stats_timer {
+	STATS_READ,	/* reading the input */
+	STATS_RENDER,	/* write_text(), flushes included */
+	STATS_FLUSH,	/* handing rings to the sink: packing or FLAC encoding */
+	STATS_CLOSE,	/* finishing outputs, the FLAC encoder's last frames and verify */
+	STATS_TIMERS
+};
+
+enum stats_counter {
+	STATS_INPUT_BYTES,
+	STATS_CHARACTERS,
+	STATS_SAMPLES,
+	STATS_OUTPUT_BYTES,
+	STATS_OUTPUTS,
+	STATS_FLUSHES,
+	STATS_REALLOCS,
+	STATS_PEAK_BUFFER,
+	STATS_COUNTERS
+};
+
+extern uint64_t stats_timers[STATS_TIMERS];
+extern uint64_t stats_counters[STATS_COUNTERS];
+
+static inline uint64_t stats_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void stats_peak(enum stats_counter counter, uint64_t n) {
+	uint64_t peak = __atomic_load_n(&stats_counters[counter], __ATOMIC_RELAXED);
+
+	while (n > peak && !__atomic_compare_exchange_n(&stats_counters[counter], &peak, n, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		continue;
+	}
+}
+
+/* STATS_CLOCK() goes last in a block's declarations */
+#define STATS_CLOCK(name) uint64_t name = stats_now()
+#define STATS_RESTART(name) ((name) = stats_now())
+#define STATS_TIME(timer, name) __atomic_fetch_add(&stats_timers[timer], stats_now() - (name), __ATOMIC_RELAXED)
+#define STATS_ADD(counter, n) __atomic_fetch_add(&stats_counters[counter], (uint64_t) (n), __ATOMIC_RELAXED)
+#define STATS_PEAK(counter, n) stats_peak(counter, (uint64_t) (n))
+
+#else
+
+#define STATS_CLOCK(name)
+#define STATS_RESTART(name)
+#define STATS_TIME(timer, name)
+#define STATS_ADD(counter, n)
+#define STATS_PEAK(counter, n)
+
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+ /*
+    synth.h - morse code waveform synthesis for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TEXT_TO_CW_SYNTH_H
+#define TEXT_TO_CW_SYNTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEFAULT_FREQUENCY (600)
+#define DEFAULT_WPM (18)
+#define DEFAULT_FWPM DEFAULT_WPM
+#define DEFAULT_SAMPLE_RATE (44100)
+#define DEFAULT_CHANNELS (1)
+#define DEFAULT_BPS (16)
+#define DEFAULT_VOLUME (16384 * (0.50))
+
+#define MIN_SAMPLE_RATE (8000)
+#define MAX_SAMPLE_RATE (96000)
+
+extern const int volume;
+extern const int channels;
+
+/* whether n is one of the depths the outputs support: 8, 16 or 24 */
+int valid_bps(int n);
+
+/* phase_continuous tones are cached per start phase, in this many steps of a cycle */
+#define PHASE_STEPS (64)
+
+#define DEFAULT_WEIGHT (50)
+#define MIN_WEIGHT (25)
+#define MAX_WEIGHT (75)
+#define MAX_JITTER (50)
+#define MAX_DRIFT (50)
+#define DEFAULT_SEED (1)
+
+/*
+ * a human fist instead of a perfect keyer: every element and space gets
+ * its own length, planned from a seeded random sequence so the same seed
+ * keys the same text the same way every time.
+ */
+struct fist {
+	/* percent of a dit and the space after it that's keyed, 50 for even */
+	int weight;
+
+	/* each element and space is up to this percent longer or shorter */
+	int jitter;
+
+	/* the speed wanders, slowly, up to this percent either way */
+	int drift;
+
+	unsigned long seed;
+};
+
+/* where an output is in its fist's plan */
+struct keyer {
+	uint64_t state;
+	size_t elements;
+	double speed_from;
+	double speed_to;
+
+	/* what rounding lengths to whole samples has added or taken off so far */
+	double carry;
+};
+
+/*
+ * the cached waveforms: the shaped dit and dah, every character's glyph
+ * (its tones and the intra character spaces between them) and each tone
+ * per start phase and a sample longer. they only depend on wpm, frequency
+ * and sample rate, so every synth that agrees on those shares one
+ * refcounted copy.
+ */
+struct tones;
+
+/*
+ * everything one stream of morse is rendered from. set the parameters
+ * (default_synth() fills in the defaults), then init_space(), init_tone()
+ * and init_glyphs() build the rest. a synth's waveforms are rendered
+ * on first use and never change once published, so synths (and threads
+ * using one synth) can render at the same time without locking.
+ */
+struct synth {
+	int wpm;
+	int fwpm;
+	double frequency;
+
+	/*
+	 * the output format. tones are always rendered and cached as 16-bit
+	 * samples at volume; widen_samples() rescales them to bps on the
+	 * way into the ring.
+	 */
+	double sample_rate;
+	int bps;
+
+	/* keep the carrier's phase running across elements instead of restarting each tone */
+	int phase_continuous;
+
+	/* keying with a fist ignores phase_continuous, every tone starts at phase zero */
+	struct fist fist;
+
+	/* shared with other synths, from init_tone() until exit_tone() */
+	struct tones *tones;
+
+	/*
+	 * exact timing, from init_space(): a sample is sample_ticks long, a
+	 * unit at wpm unit_ticks and a unit at fwpm gap_ticks. a unit is
+	 * seldom a whole number of samples, so every edge is rounded to the
+	 * nearest sample on its own and the rounding never adds up.
+	 */
+	uint64_t sample_ticks;
+	uint64_t unit_ticks;
+	uint64_t gap_ticks;
+
+	/* how far write_character() moves the timeline for each character, from init_glyphs() */
+	uint64_t ticks[256];
+};
+
+void default_synth(struct synth *synth);
+
+/* whether synth has a fist that isn't a perfect keyer's */
+int is_humanized(const struct synth *synth);
+
+/* where the next element starts: ticks from the sample at origin */
+struct timeline {
+	size_t origin;
+	uint64_t ticks;
+};
+
+/*
+ * synthesized samples are staged in a fixed size ring and handed to the
+ * consumer each time it fills, so memory use doesn't grow with the input.
+ * the ring holds the encoder's own 32-bit samples and is sized to a
+ * multiple of the libFLAC block size so it can consume it without copying.
+ */
+#define RINGSIZE (4096)
+
+struct output {
+	int32_t pcm[RINGSIZE * DEFAULT_CHANNELS];
+	size_t ring_len;
+
+	/* what's being rendered; write_character() fills its glyph cache on demand */
+	struct synth *synth;
+
+	/* number of samples kept so far */
+	size_t total_samples;
+
+	/* offset in the whole rendering of the next sample, kept or not */
+	size_t position;
+
+	/* where position should be once the next element is written */
+	struct timeline timeline;
+
+	/* the fist's plan so far, from the start of the output */
+	struct keyer keyer;
+
+	/* drop the first skip samples and keep at most limit samples */
+	size_t skip;
+	size_t limit;
+
+	/* hand the ring over once this many samples are staged, at most RINGSIZE */
+	size_t period;
+
+	/* called with a full (or, on finish, partial) ring */
+	void (*flush)(struct output *out);
+	void *data;
+
+	/*
+	 * when set, samples bypass the ring and are handed over as they are
+	 * written: data points into the tone and glyph caches (NULL for
+	 * silence) and stays valid until exit_tone(), so it may be kept
+	 * rather than copied.
+	 */
+	void (*segment)(struct output *out, const int16_t *data, size_t len);
+
+	/*
+	 * with can_fail, a tone that can't be made for want of memory is
+	 * written as silence and failed is set; without it, that exits.
+	 */
+	int can_fail;
+	int failed;
+};
+
+/* 16-bit cached samples to bps-bit ring samples */
+void widen_samples(int32_t * restrict dst, const int16_t * restrict src, size_t n, int bps);
+
+void init_output(struct output *out, struct synth *synth, void (*flush)(struct output *out), void *data);
+void flush_output(struct output *out);
+
+/* samples that aren't morse; the timeline carries on from after them */
+void write_result(struct output *out, const int16_t *data, size_t len);
+void write_silence(struct output *out, size_t len);
+
+/* take (building it if need be) and drop a reference to the shared tones */
+int init_tone(struct synth *synth);
+void exit_tone(struct synth *synth);
+
+void init_space(struct synth *synth);
+void exit_space(struct synth *synth);
+
+/* needs init_tone(); prerendering moves the cost up front, after which writing can't run out of memory */
+int init_glyphs(struct synth *synth, int prerender);
+void exit_glyphs(struct synth *synth);
+
+void write_inter_character_space(struct output *out);
+void write_character(struct output *out, unsigned char c);
+void write_text(struct output *out, const unsigned char *text, size_t len);
+
+/* valid once init_glyphs() has run */
+int is_word_space(unsigned char c);
+size_t measure_inter_character_space(const struct synth *synth);
+size_t measure_text(const struct synth *synth, const unsigned char *text, size_t len);
+
+/*
+ * the sample a timeline is at, and moving it on as write_character() and
+ * write_inter_character_space() would, for finding where characters
+ * start without rendering them. not for a humanized synth.
+ */
+size_t timeline_position(const struct synth *synth, const struct timeline *timeline);
+void advance_character(const struct synth *synth, struct timeline *timeline, unsigned char c);
+void advance_inter_character_space(const struct synth *synth, struct timeline *timeline);
+
+#endif
@@ -0,0 +1,109 @@
+ /*
+    texttomorse.h - libtexttomorse, text to morse code audio in process
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TEXT_TO_CW_TEXTTOMORSE_H
+#define TEXT_TO_CW_TEXTTOMORSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define TTM_EXPORT __attribute__((visibility("default")))
+#else
+#define TTM_EXPORT
+#endif
+
+struct ttm_params {
+	int wpm;
+
+	/* Farnsworth spacing, 0 for the same as wpm */
+	int fwpm;
+	double frequency;
+	int sample_rate;
+	int bps;
+
+	/* keep the carrier's phase running across elements */
+	int phase_continuous;
+
+	/*
+	 * a human fist: percent of each dit and the space after it that's
+	 * keyed (50 for even), percent each element may vary, percent the
+	 * speed may wander, and the seed both of those are drawn from
+	 */
+	int weight;
+	int jitter;
+	int drift;
+	unsigned long seed;
+};
+
+/*
+ * one independent stream of morse. any number of contexts may be used
+ * at once from different threads; a single context must not be used
+ * from two threads at the same time.
+ */
+struct ttm;
+
+/* the same defaults as the text-to-morse command */
+TTM_EXPORT void ttm_default_params(struct ttm_params *params);
+
+/* NULL if params are out of range or memory runs out */
+TTM_EXPORT struct ttm *ttm_open(const struct ttm_params *params);
+
+/*
+ * queue UTF-8 text to be rendered after whatever was fed before; -1 if
+ * memory runs out. a character or prosign split between two feeds is
+ * rendered once the rest of it has been fed.
+ */
+TTM_EXPORT int ttm_feed(struct ttm *ttm, const char *text, size_t len);
+
+/*
+ * mark the end of the text fed so far: whatever is still waiting for
+ * the rest of it, like "<SK" or half a UTF-8 sequence, is rendered as
+ * the characters it has or dropped if there are none. -1 if memory runs
+ * out. more text may be fed after it, as the start of a new text.
+ */
+TTM_EXPORT int ttm_finish(struct ttm *ttm);
+
+/*
+ * render up to n mono samples into pcm, signed and scaled to params.bps,
+ * and return how many were written. 0 means everything fed so far has
+ * been read (feed more and carry on), unless ttm_failed() says otherwise.
+ */
+TTM_EXPORT size_t ttm_read(struct ttm *ttm, int32_t *pcm, size_t n);
+
+/*
+ * 1 if memory ran out while rendering, else 0. the samples being queued
+ * when it did are lost, whatever was read before them is all there will
+ * be, and every ttm_read() after returns 0; the context can only be
+ * closed.
+ */
+TTM_EXPORT int ttm_failed(const struct ttm *ttm);
+
+TTM_EXPORT void ttm_close(struct ttm *ttm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
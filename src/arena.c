@@ -0,0 +1,136 @@
+ /*
+    arena.c - bump allocation with a single teardown for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+/* the header takes the first cache line of a chunk, the rest is handed out */
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	int mapped;
+};
+
+#define CHUNK_HEADER (((sizeof(struct arena_chunk) + ARENA_ALIGN - 1) / ARENA_ALIGN) * ARENA_ALIGN)
+
+static struct arena_chunk *new_chunk(size_t size) {
+	struct arena_chunk *chunk = NULL;
+	void *p = NULL;
+	int mapped = 0;
+
+	if (size >= ARENA_HUGE_CHUNK) {
+		/* whole huge pages, so there's no partial one at the end */
+		size = (size + ARENA_HUGE_CHUNK - 1) / ARENA_HUGE_CHUNK * ARENA_HUGE_CHUNK;
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			return NULL;
+		}
+#ifdef MADV_HUGEPAGE
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+		mapped = 1;
+	} else if (posix_memalign(&p, ARENA_ALIGN, size) != 0) {
+		return NULL;
+	}
+
+	chunk = (struct arena_chunk *) p;
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = CHUNK_HEADER;
+	chunk->mapped = mapped;
+
+	return chunk;
+}
+
+static void free_chunk(struct arena_chunk *chunk) {
+	if (chunk->mapped) {
+		munmap(chunk, chunk->size);
+	} else {
+		free(chunk);
+	}
+}
+
+void init_arena(struct arena *arena) {
+	memset(arena, '\0', sizeof(struct arena));
+	pthread_mutex_init(&arena->lock, NULL);
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+	struct arena_chunk *chunk = NULL;
+	size_t want = 0;
+	void *p = NULL;
+
+	size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+	pthread_mutex_lock(&arena->lock);
+
+	chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		/* doubling keeps the number of chunks logarithmic in what's allocated */
+		want = arena->total < ARENA_MIN_CHUNK ? ARENA_MIN_CHUNK : arena->total;
+		want = want < CHUNK_HEADER + size ? CHUNK_HEADER + size : want;
+
+		chunk = new_chunk(want);
+		if (chunk == NULL) {
+			pthread_mutex_unlock(&arena->lock);
+			return NULL;
+		}
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->total += chunk->size;
+	}
+
+	p = (char *) chunk + chunk->used;
+	chunk->used += size;
+
+	pthread_mutex_unlock(&arena->lock);
+
+	return p;
+}
+
+char *arena_strdup(struct arena *arena, const char *s) {
+	size_t len = strlen(s) + 1;
+	char *p = (char *) arena_alloc(arena, len);
+
+	if (p != NULL) {
+		memcpy(p, s, len);
+	}
+
+	return p;
+}
+
+void free_arena(struct arena *arena) {
+	struct arena_chunk *chunk = NULL;
+	struct arena_chunk *next = NULL;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free_chunk(chunk);
+	}
+
+	arena->chunks = NULL;
+	arena->total = 0;
+	pthread_mutex_destroy(&arena->lock);
+}
@@ -0,0 +1,332 @@
+ /*
+    batch.c - batch conversion for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "input.h"
+#include "parallel.h"
+#include "sink.h"
+#include "synth.h"
+
+struct job {
+	char *input;
+	char *output;
+	const struct sink_type *type;
+};
+
+struct batch {
+	struct synth *synth;
+
+	/* format for outputs without a known extension, and every one in directory mode */
+	const struct sink_type *type;
+
+	struct job *jobs;
+	size_t njobs;
+	size_t cap;
+
+	/* the jobs' paths, freed together */
+	struct arena paths;
+
+	/* next job to hand out and the totals reported at the end */
+	size_t next;
+	size_t failed;
+	size_t samples;
+	size_t bytes;
+
+	pthread_mutex_t lock;
+};
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *xstrdup(struct arena *arena, const char *s) {
+	char *p = arena_strdup(arena, s);
+
+	if (p == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static void add_job(struct batch *batch, const char *input, const char *output) {
+	if (batch->njobs == batch->cap) {
+		batch->cap = batch->cap == 0 ? 64 : batch->cap * 2;
+		batch->jobs = (struct job *) realloc(batch->jobs, batch->cap * sizeof(struct job));
+		if (batch->jobs == NULL) {
+			fprintf(stderr, "malloc failed :(\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	batch->jobs[batch->njobs].input = xstrdup(&batch->paths, input);
+	batch->jobs[batch->njobs].output = xstrdup(&batch->paths, output);
+	batch->jobs[batch->njobs].type = sink_type_for_path(output, batch->type);
+	batch->njobs++;
+}
+
+/* one "INPUT.TXT OUTPUT.FLAC" pair per line, blank lines and # comments ignored */
+static int read_manifest(struct batch *batch, char *path) {
+
+	FILE *manifest = NULL;
+	char line[8192];
+	char *input = NULL;
+	char *output = NULL;
+	char *end = NULL;
+	int lineno = 0;
+
+	manifest = fopen(path, "r");
+	if (manifest == NULL) {
+		fprintf(stderr, "Could not open manifest '%s'\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), manifest) != NULL) {
+		lineno++;
+
+		for (input = line; isspace((unsigned char) *input); input++) {
+			/* skip leading space */
+		}
+		if (*input == '\0' || *input == '#') {
+			continue;
+		}
+
+		for (output = input; *output != '\0' && !isspace((unsigned char) *output); output++) {
+			/* find the end of the input path */
+		}
+		if (*output != '\0') {
+			*output++ = '\0';
+		}
+		while (isspace((unsigned char) *output)) {
+			output++;
+		}
+		for (end = output + strlen(output); end > output && isspace((unsigned char) end[-1]); end--) {
+			/* trim trailing space */
+		}
+		*end = '\0';
+
+		if (*output == '\0') {
+			fprintf(stderr, "%s:%d: expected INPUT.TXT OUTPUT.FLAC\n", path, lineno);
+			fclose(manifest);
+			return -1;
+		}
+
+		add_job(batch, input, output);
+	}
+
+	fclose(manifest);
+	return 0;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+	return strcmp(((const struct job *) a)->input, ((const struct job *) b)->input);
+}
+
+/* every regular file in indir becomes outdir/NAME.flac, or the batch format's extension */
+static int read_directory(struct batch *batch, char *indir, char *outdir) {
+
+	DIR *dir = NULL;
+	struct dirent *entry = NULL;
+	struct stat st;
+	char input[4096];
+	char output[4096];
+	char *dot = NULL;
+
+	dir = opendir(indir);
+	if (dir == NULL) {
+		fprintf(stderr, "Could not open input directory '%s'\n", indir);
+		return -1;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+
+		snprintf(input, sizeof(input), "%s/%s", indir, entry->d_name);
+		if (stat(input, &st) == -1 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+
+		snprintf(output, sizeof(output), "%s/%s", outdir, entry->d_name);
+		dot = strrchr(output + strlen(outdir) + 1, '.');
+		if (dot != NULL) {
+			*dot = '\0';
+		}
+		strncat(output, batch->type->extension, sizeof(output) - strlen(output) - 1);
+
+		add_job(batch, input, output);
+	}
+
+	closedir(dir);
+
+	qsort(batch->jobs, batch->njobs, sizeof(struct job), compare_jobs);
+	return 0;
+}
+
+static int convert(struct batch *batch, struct output *out, struct sink *sink, struct job *job, size_t *bytes) {
+
+	struct text text;
+	struct stat st;
+	int rc = 0;
+
+	if (open_text(&text, job->input) == -1) {
+		fprintf(stderr, "Could not open input file '%s'\n", job->input);
+		return -1;
+	}
+
+	/* one sink per worker, replaced only when the format changes */
+	if (sink->type != job->type) {
+		delete_sink(sink);
+		if (new_sink(sink, job->type) == -1) {
+			fprintf(stderr, "ERROR: allocating %s output\n", job->type->name);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	rc = open_sink(sink, out, batch->synth, job->output, measure_text(batch->synth, text.bytes, text.len));
+	if (rc == 0) {
+		write_text(out, text.bytes, text.len);
+		rc = close_sink(sink, out);
+	}
+
+	close_text(&text);
+
+	*bytes = rc == 0 && stat(job->output, &st) == 0 ? st.st_size : 0;
+	return rc;
+}
+
+static void *work(void *arg) {
+
+	struct batch *batch = (struct batch *) arg;
+	struct sink sink;
+	struct output *out = NULL;
+	struct job *job = NULL;
+	double start = 0;
+	double elapsed = 0;
+	size_t bytes = 0;
+	int rc = 0;
+
+	memset(&sink, '\0', sizeof(sink));
+	out = (struct output *) malloc(sizeof(struct output));
+	if (out == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&batch->lock);
+		job = batch->next < batch->njobs ? &batch->jobs[batch->next++] : NULL;
+		pthread_mutex_unlock(&batch->lock);
+
+		if (job == NULL) {
+			break;
+		}
+
+		start = now();
+		rc = convert(batch, out, &sink, job, &bytes);
+		elapsed = now() - start;
+
+		if (rc == -1) {
+			fprintf(stderr, "%s: FAILED\n", job->input);
+		} else {
+			fprintf(stderr, "%s -> %s: %.1fs of audio in %.3fs (%.1fx real time, %.1f Msamples/s, %.2f MB/s)\n",
+				job->input, job->output, out->total_samples / batch->synth->sample_rate, elapsed,
+				out->total_samples / batch->synth->sample_rate / elapsed,
+				out->total_samples / elapsed / 1e6, bytes / elapsed / 1e6);
+		}
+
+		pthread_mutex_lock(&batch->lock);
+		if (rc == -1) {
+			batch->failed++;
+		} else {
+			batch->samples += out->total_samples;
+			batch->bytes += bytes;
+		}
+		pthread_mutex_unlock(&batch->lock);
+	}
+
+	free(out);
+	delete_sink(&sink);
+
+	return NULL;
+}
+
+int encode_batch(struct synth *synth, int argc, char *argv[], const struct sink_type *type, int jobs) {
+
+	struct batch batch;
+	pthread_t threads[MAX_JOBS];
+	double start = 0;
+	double elapsed = 0;
+	int rc = 0;
+	int i = 0;
+
+	memset(&batch, '\0', sizeof(batch));
+	batch.synth = synth;
+	batch.type = type;
+	pthread_mutex_init(&batch.lock, NULL);
+	init_arena(&batch.paths);
+
+	rc = argc == 1 ? read_manifest(&batch, argv[0]) : read_directory(&batch, argv[0], argv[1]);
+	if (rc == -1) {
+		free_arena(&batch.paths);
+		free(batch.jobs);
+		return -1;
+	}
+
+	start = now();
+
+	for (i = 0; i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, work, &batch) != 0) {
+			fprintf(stderr, "ERROR: starting worker thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < jobs; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	elapsed = now() - start;
+
+	fprintf(stderr, "batch: %lu files, %lu failed, %.1fs of audio in %.3fs (%.1f files/s, %.1fx real time, %.1f Msamples/s, %.2f MB/s)\n",
+		(unsigned long) batch.njobs, (unsigned long) batch.failed, batch.samples / synth->sample_rate, elapsed,
+		batch.njobs / elapsed, batch.samples / synth->sample_rate / elapsed,
+		batch.samples / elapsed / 1e6, batch.bytes / elapsed / 1e6);
+
+	free_arena(&batch.paths);
+	free(batch.jobs);
+	pthread_mutex_destroy(&batch.lock);
+
+	return batch.failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,345 @@
+ /*
+    cache.c - rendered audio kept by what it was rendered from
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+#define CACHE_MIN_BUCKETS (64)
+
+#define FNV_OFFSET (0xcbf29ce484222325ULL)
+#define FNV_PRIME (0x100000001b3ULL)
+
+struct entry {
+	/* first, so the public part and the entry are the same pointer */
+	struct cache_entry public;
+
+	/* a copy of the key that owns its text */
+	struct cache_key key;
+	size_t size;
+
+	/* one for the cache while it's in it, one per cache_get() / cache_put() */
+	size_t refs;
+
+	/* hash chain, and the LRU list with the most recently used at the head */
+	struct entry *chain;
+	struct entry *newer;
+	struct entry *older;
+};
+
+struct cache {
+	pthread_mutex_t lock;
+
+	struct entry **buckets;
+	size_t nbuckets;
+
+	struct entry *newest;
+	struct entry *oldest;
+
+	size_t capacity;
+	struct cache_stats stats;
+};
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len) {
+	const unsigned char *p = (const unsigned char *) data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ p[i]) * FNV_PRIME;
+	}
+
+	return h;
+}
+
+/* field by field: there's padding in the struct */
+static uint64_t hash_key(const struct cache_key *key) {
+	uint64_t h = FNV_OFFSET;
+
+	h = fnv(h, &key->type, sizeof(key->type));
+	h = fnv(h, &key->wpm, sizeof(key->wpm));
+	h = fnv(h, &key->fwpm, sizeof(key->fwpm));
+	h = fnv(h, &key->frequency, sizeof(key->frequency));
+	h = fnv(h, &key->sample_rate, sizeof(key->sample_rate));
+	h = fnv(h, &key->bps, sizeof(key->bps));
+	h = fnv(h, &key->phase_continuous, sizeof(key->phase_continuous));
+	h = fnv(h, &key->fist.weight, sizeof(key->fist.weight));
+	h = fnv(h, &key->fist.jitter, sizeof(key->fist.jitter));
+	h = fnv(h, &key->fist.drift, sizeof(key->fist.drift));
+	h = fnv(h, &key->fist.seed, sizeof(key->fist.seed));
+	h = fnv(h, &key->text_len, sizeof(key->text_len));
+
+	return fnv(h, key->text, key->text_len);
+}
+
+static int same_key(const struct cache_key *a, const struct cache_key *b) {
+	return a->hash == b->hash && a->type == b->type && a->wpm == b->wpm && a->fwpm == b->fwpm &&
+		a->frequency == b->frequency && a->sample_rate == b->sample_rate && a->bps == b->bps &&
+		a->phase_continuous == b->phase_continuous && a->fist.weight == b->fist.weight &&
+		a->fist.jitter == b->fist.jitter && a->fist.drift == b->fist.drift && a->fist.seed == b->fist.seed &&
+		a->text_len == b->text_len && memcmp(a->text, b->text, a->text_len) == 0;
+}
+
+void make_cache_key(struct cache_key *key, const struct synth *synth, const struct sink_type *type, const unsigned char *text, size_t text_len) {
+	memset(key, '\0', sizeof(struct cache_key));
+
+	key->type = type;
+	key->wpm = synth->wpm;
+	key->fwpm = synth->fwpm;
+	key->frequency = synth->frequency;
+	key->sample_rate = synth->sample_rate;
+	key->bps = synth->bps;
+	key->phase_continuous = synth->phase_continuous;
+	key->fist = synth->fist;
+	key->text = text;
+	key->text_len = text_len;
+	key->hash = hash_key(key);
+}
+
+struct cache *new_cache(size_t capacity) {
+	struct cache *cache = NULL;
+
+	cache = (struct cache *) calloc(1, sizeof(struct cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	cache->nbuckets = CACHE_MIN_BUCKETS;
+	cache->buckets = (struct entry **) calloc(cache->nbuckets, sizeof(struct entry *));
+	if (cache->buckets == NULL) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->capacity = capacity;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	return cache;
+}
+
+static void free_entry(struct entry *entry) {
+	free((void *) entry->public.data);
+	free((void *) entry->key.text);
+	free(entry);
+}
+
+/* the caller holds the lock */
+static void unref(struct entry *entry) {
+	entry->refs--;
+	if (entry->refs == 0) {
+		free_entry(entry);
+	}
+}
+
+static void unlink_lru(struct cache *cache, struct entry *entry) {
+	if (entry->newer != NULL) {
+		entry->newer->older = entry->older;
+	} else {
+		cache->newest = entry->older;
+	}
+
+	if (entry->older != NULL) {
+		entry->older->newer = entry->newer;
+	} else {
+		cache->oldest = entry->newer;
+	}
+
+	entry->newer = entry->older = NULL;
+}
+
+static void push_lru(struct cache *cache, struct entry *entry) {
+	entry->older = cache->newest;
+	entry->newer = NULL;
+
+	if (cache->newest != NULL) {
+		cache->newest->newer = entry;
+	} else {
+		cache->oldest = entry;
+	}
+	cache->newest = entry;
+}
+
+/* take the oldest out; anyone still sending it keeps it alive until they let go */
+static void evict(struct cache *cache) {
+	struct entry *entry = cache->oldest;
+	struct entry **p = &cache->buckets[entry->key.hash & (cache->nbuckets - 1)];
+
+	while (*p != entry) {
+		p = &(*p)->chain;
+	}
+	*p = entry->chain;
+
+	unlink_lru(cache, entry);
+
+	cache->stats.entries--;
+	cache->stats.bytes -= entry->size;
+	cache->stats.evictions++;
+
+	unref(entry);
+}
+
+/* twice the buckets once there's an entry per bucket; no harm done if there's no memory for it */
+static void grow(struct cache *cache) {
+	struct entry **buckets = NULL;
+	struct entry *entry = NULL;
+	struct entry *next = NULL;
+	size_t nbuckets = cache->nbuckets * 2;
+	size_t i;
+
+	buckets = (struct entry **) calloc(nbuckets, sizeof(struct entry *));
+	if (buckets == NULL) {
+		return;
+	}
+
+	for (i = 0; i < cache->nbuckets; i++) {
+		for (entry = cache->buckets[i]; entry != NULL; entry = next) {
+			next = entry->chain;
+			entry->chain = buckets[entry->key.hash & (nbuckets - 1)];
+			buckets[entry->key.hash & (nbuckets - 1)] = entry;
+		}
+	}
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->nbuckets = nbuckets;
+}
+
+/* the caller holds the lock */
+static struct entry *find(struct cache *cache, const struct cache_key *key) {
+	struct entry *entry = NULL;
+
+	for (entry = cache->buckets[key->hash & (cache->nbuckets - 1)]; entry != NULL; entry = entry->chain) {
+		if (same_key(&entry->key, key)) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+const struct cache_entry *cache_get(struct cache *cache, const struct cache_key *key) {
+	struct entry *entry = NULL;
+
+	pthread_mutex_lock(&cache->lock);
+
+	entry = find(cache, key);
+	if (entry != NULL) {
+		unlink_lru(cache, entry);
+		push_lru(cache, entry);
+		entry->refs++;
+		cache->stats.hits++;
+	} else {
+		cache->stats.misses++;
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return entry == NULL ? NULL : &entry->public;
+}
+
+const struct cache_entry *cache_put(struct cache *cache, const struct cache_key *key, unsigned char *data, size_t len) {
+	struct entry *entry = NULL;
+	struct entry *found = NULL;
+	unsigned char *text = NULL;
+	size_t size = sizeof(struct entry) + key->text_len + len;
+
+	if (size > cache->capacity) {
+		return NULL;
+	}
+
+	entry = (struct entry *) calloc(1, sizeof(struct entry));
+	text = (unsigned char *) malloc(key->text_len == 0 ? 1 : key->text_len);
+	if (entry == NULL || text == NULL) {
+		free(entry);
+		free(text);
+		return NULL;
+	}
+	memcpy(text, key->text, key->text_len);
+
+	entry->public.data = data;
+	entry->public.len = len;
+	entry->key = *key;
+	entry->key.text = text;
+	entry->size = size;
+	entry->refs = 2;
+
+	pthread_mutex_lock(&cache->lock);
+
+	/* rendered twice at once; the first one in wins */
+	found = find(cache, key);
+	if (found != NULL) {
+		found->refs++;
+		pthread_mutex_unlock(&cache->lock);
+		free_entry(entry);
+		return &found->public;
+	}
+
+	while (cache->stats.bytes + size > cache->capacity) {
+		evict(cache);
+	}
+
+	if (cache->stats.entries >= cache->nbuckets) {
+		grow(cache);
+	}
+
+	entry->chain = cache->buckets[key->hash & (cache->nbuckets - 1)];
+	cache->buckets[key->hash & (cache->nbuckets - 1)] = entry;
+	push_lru(cache, entry);
+
+	cache->stats.entries++;
+	cache->stats.bytes += size;
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return &entry->public;
+}
+
+void cache_release(struct cache *cache, const struct cache_entry *entry) {
+	if (entry == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	unref((struct entry *) entry);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void cache_get_stats(struct cache *cache, struct cache_stats *stats) {
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* references still held are the caller's problem */
+void delete_cache(struct cache *cache) {
+	if (cache == NULL) {
+		return;
+	}
+
+	while (cache->oldest != NULL) {
+		evict(cache);
+	}
+
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->buckets);
+	free(cache);
+}
@@ -0,0 +1,237 @@
+ /*
+    encode.c - FLAC encoding for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+
+/* example_c_encode_file - Simple FLAC file encoder using libFLAC
+ * Copyright (C) 2007-2009  Josh Coalson
+ * Copyright (C) 2011-2024  Xiph.Org Foundation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <FLAC/metadata.h>
+#include <FLAC/stream_encoder.h>
+
+#include "encode.h"
+#include "progress.h"
+#include "sink.h"
+#include "synth.h"
+
+int verify = DEFAULT_VERIFY;
+int compression_level = DEFAULT_COMPRESSION_LEVEL;
+unsigned flac_blocksize = DEFAULT_BLOCKSIZE;
+const char *flac_apodization = NULL;
+
+FLAC__bool setup_encoder(FLAC__StreamEncoder *encoder, const struct synth *synth, size_t expected_samples) {
+
+	FLAC__bool ok = true;
+
+	/* TC: the sample format comes from the synth, channels is a global */
+
+        ok &= FLAC__stream_encoder_set_verify(encoder, verify ? true : false);
+        ok &= FLAC__stream_encoder_set_compression_level(encoder, compression_level);
+
+	/* these override what the compression level picked, so they go after it */
+	if (flac_blocksize != DEFAULT_BLOCKSIZE) {
+		ok &= FLAC__stream_encoder_set_blocksize(encoder, flac_blocksize);
+	}
+	if (flac_apodization != NULL) {
+		ok &= FLAC__stream_encoder_set_apodization(encoder, flac_apodization);
+	}
+        ok &= FLAC__stream_encoder_set_channels(encoder, channels);
+        ok &= FLAC__stream_encoder_set_bits_per_sample(encoder, synth->bps);
+        ok &= FLAC__stream_encoder_set_sample_rate(encoder, synth->sample_rate);
+        ok &= FLAC__stream_encoder_set_total_samples_estimate(encoder, expected_samples);
+
+	return ok;
+}
+
+void encode_output(struct output *out) {
+
+	FLAC__StreamEncoder *encoder = (FLAC__StreamEncoder *) out->data;
+	FLAC__bool ok = true;
+
+	/* before, so what the encoder reports is never ahead of it */
+	progress_synthesized(out->ring_len);
+
+	ok = FLAC__stream_encoder_process_interleaved(encoder, out->pcm, out->ring_len);
+	if (!ok) {
+		fprintf(stderr, "ERROR: encoding: %s\n", FLAC__StreamEncoderStateString[FLAC__stream_encoder_get_state(encoder)]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* libFLAC's totals for a file, after every frame */
+static void report_file(const FLAC__StreamEncoder *encoder, FLAC__uint64 bytes_written, FLAC__uint64 samples_written, uint32_t frames_written, uint32_t total_frames_estimate, void *client_data) {
+	(void) encoder;
+	(void) total_frames_estimate;
+	(void) client_data;
+
+	progress_encoded(samples_written, frames_written, bytes_written);
+}
+
+/* frames go out on stdout as soon as libFLAC has them */
+static FLAC__StreamEncoderWriteStatus write_stdout(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, uint32_t samples, uint32_t current_frame, void *client_data) {
+	(void) encoder;
+	(void) current_frame;
+	(void) client_data;
+
+	if (fwrite(buffer, 1, bytes, stdout) != bytes || fflush(stdout) != 0) {
+		return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+	}
+
+	/* metadata is written with samples 0 */
+	progress_wrote(samples, samples > 0, bytes);
+
+	return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+/* or into memory, for open_encoder_buffer() */
+static FLAC__StreamEncoderWriteStatus write_buffer(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, uint32_t samples, uint32_t current_frame, void *client_data) {
+	(void) encoder;
+	(void) samples;
+	(void) current_frame;
+
+	if (append_buffer((struct buffer *) client_data, buffer, bytes) == -1) {
+		return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+	}
+
+	return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+/* to filepath, or to buffer when it isn't NULL */
+static int start_encoder(struct output *out, struct synth *synth, FLAC__StreamEncoder *encoder, char *filepath, struct buffer *buffer, size_t expected_samples) {
+
+	FLAC__bool ok = true;
+	FLAC__StreamEncoderInitStatus init_status;
+
+	ok &= setup_encoder(encoder, synth, expected_samples);
+
+        /* initialize encoder */
+        if (ok) {
+                if (buffer != NULL) {
+                        init_status = FLAC__stream_encoder_init_stream(encoder, write_buffer, /*seek_callback=*/NULL, /*tell_callback=*/NULL, /*metadata_callback=*/NULL, /*client_data=*/buffer);
+                } else if (strcmp(filepath, "-") == 0) {
+                        init_status = FLAC__stream_encoder_init_stream(encoder, write_stdout, /*seek_callback=*/NULL, /*tell_callback=*/NULL, /*metadata_callback=*/NULL, /*client_data=*/NULL);
+                } else {
+                        init_status = FLAC__stream_encoder_init_file(encoder, filepath, /*progress_callback*/report_file, /*client_data=*/NULL);
+                }
+                if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+                        fprintf(stderr, "ERROR: initializing encoder: %s\n", FLAC__StreamEncoderInitStatusString[init_status]);
+                        ok = false;
+                }
+        }
+
+	if (!ok) {
+		/* puts the encoder back in the uninitialized state so it can be reused */
+		FLAC__stream_encoder_finish(encoder);
+		return -1;
+	}
+
+	init_output(out, synth, encode_output, encoder);
+	return 0;
+}
+
+int open_encoder(struct output *out, struct synth *synth, FLAC__StreamEncoder *encoder, char *filepath, size_t expected_samples) {
+	return start_encoder(out, synth, encoder, filepath, NULL, expected_samples);
+}
+
+int open_encoder_buffer(struct output *out, struct synth *synth, FLAC__StreamEncoder *encoder, struct buffer *buffer, size_t expected_samples) {
+	return start_encoder(out, synth, encoder, NULL, buffer, expected_samples);
+}
+
+int close_encoder(struct output *out) {
+
+	FLAC__StreamEncoder *encoder = (FLAC__StreamEncoder *) out->data;
+	FLAC__bool ok = true;
+
+	flush_output(out);
+
+        ok &= FLAC__stream_encoder_finish(encoder);
+
+	return ok ? 0 : -1;
+}
+
+void init_encoder(struct output *out, struct synth *synth, char *filepath, size_t expected_samples) {
+
+	FLAC__StreamEncoder *encoder = NULL;
+
+	if ((encoder = FLAC__stream_encoder_new()) == NULL) {
+		fprintf(stderr, "ERROR: allocating encoder\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (open_encoder(out, synth, encoder, filepath, expected_samples) == -1) {
+		FLAC__stream_encoder_delete(encoder);
+		exit(EXIT_FAILURE);
+	}
+}
+
+void finish_encoder(struct output *out) {
+
+	FLAC__bool ok = true;
+
+	ok = close_encoder(out) == 0;
+
+        fprintf(stderr, "encoding: %s\n", ok? "succeeded" : "FAILED");
+
+        FLAC__stream_encoder_delete((FLAC__StreamEncoder *) out->data);
+	out->data = NULL;
+
+	if (!ok) {
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void *create_flac(void) {
+	return FLAC__stream_encoder_new();
+}
+
+static void destroy_flac(void *state) {
+	FLAC__stream_encoder_delete((FLAC__StreamEncoder *) state);
+}
+
+static int open_flac(struct output *out, struct synth *synth, void *state, char *filepath, size_t expected_samples) {
+	return open_encoder(out, synth, (FLAC__StreamEncoder *) state, filepath, expected_samples);
+}
+
+static int open_flac_buffer(struct output *out, struct synth *synth, void *state, struct buffer *buffer, size_t expected_samples) {
+	return open_encoder_buffer(out, synth, (FLAC__StreamEncoder *) state, buffer, expected_samples);
+}
+
+const struct sink_type flac_sink = {
+	"flac", ".flac", create_flac, destroy_flac, open_flac, open_flac_buffer, close_encoder
+};
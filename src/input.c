@@ -0,0 +1,197 @@
+ /*
+    input.c - input text for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "normalize.h"
+#include "stats.h"
+#include "synth.h"
+
+#define READSIZE (65536)
+
+static int read_fd(struct text *text, int fd) {
+
+	unsigned char *bytes = NULL;
+	unsigned char *p = NULL;
+	size_t cap = 0;
+	ssize_t n = 0;
+
+	/* to EOF, trying again when a signal interrupts a read of a pipe or terminal */
+	text->len = 0;
+	do {
+		if (cap - text->len < READSIZE) {
+			cap = cap == 0 ? READSIZE * 4 : cap * 2;
+			p = (unsigned char *) realloc(bytes, cap);
+			if (p == NULL) {
+				free(bytes);
+				return -1;
+			}
+			bytes = p;
+			STATS_ADD(STATS_REALLOCS, 1);
+			STATS_PEAK(STATS_PEAK_BUFFER, cap);
+		}
+		n = read(fd, bytes + text->len, cap - text->len);
+		if (n > 0) {
+			text->len += n;
+		}
+	} while (n > 0 || (n == -1 && errno == EINTR));
+
+	if (n == -1) {
+		free(bytes);
+		return -1;
+	}
+
+	text->bytes = bytes;
+	text->mapped = 0;
+	return 0;
+}
+
+/* most text is already plain ASCII and is left where it is */
+static int normalize_text(struct text *text) {
+
+	struct normalizer n;
+	unsigned char *bytes = NULL;
+	size_t len = 0;
+
+	if (is_normal(text->bytes, text->len)) {
+		return 0;
+	}
+
+	bytes = (unsigned char *) malloc(NORMALIZE_ROOM(text->len));
+	if (bytes == NULL) {
+		close_text(text);
+		return -1;
+	}
+
+	init_normalizer(&n);
+	len = normalize(&n, bytes, text->bytes, text->len, 1);
+
+	close_text(text);
+	text->bytes = bytes;
+	text->len = len;
+	return 0;
+}
+
+int open_text(struct text *text, const char *path) {
+
+	struct stat st;
+	void *map = NULL;
+	int fd = -1;
+	int rc = 0;
+	STATS_CLOCK(start);
+
+	memset(text, '\0', sizeof(struct text));
+
+	fd = strcmp(path, "-") == 0 ? dup(STDIN_FILENO) : open(path, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			text->bytes = (const unsigned char *) map;
+			text->len = st.st_size;
+			text->mapped = 1;
+			close(fd);
+			STATS_ADD(STATS_INPUT_BYTES, text->len);
+
+			/* normal text's pages are read as they're synthesized, that's not counted here */
+			rc = normalize_text(text);
+			STATS_TIME(STATS_READ, start);
+			return rc;
+		}
+	}
+
+	rc = read_fd(text, fd);
+	close(fd);
+	STATS_ADD(STATS_INPUT_BYTES, rc == 0 ? text->len : 0);
+
+	if (rc == 0) {
+		rc = normalize_text(text);
+	}
+	STATS_TIME(STATS_READ, start);
+
+	return rc;
+}
+
+int stream_text(struct output *out, int fd) {
+
+	struct normalizer normalizer;
+	unsigned char block[READSIZE];
+	unsigned char *text = NULL;
+	size_t len = 0;
+	ssize_t n = 0;
+	int first = 1;
+	STATS_CLOCK(start);
+
+	text = (unsigned char *) malloc(NORMALIZE_ROOM(READSIZE));
+	if (text == NULL) {
+		return -1;
+	}
+	init_normalizer(&normalizer);
+
+	for (;;) {
+		STATS_RESTART(start);
+		n = read(fd, block, sizeof(block));
+		STATS_TIME(STATS_READ, start);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+
+		/* at EOF whatever was held over from the last block is finished */
+		if (n > 0) {
+			STATS_ADD(STATS_INPUT_BYTES, n);
+		}
+		len = normalize(&normalizer, text, block, n > 0 ? n : 0, n <= 0);
+		if (len > 0) {
+			if (!first) {
+				write_inter_character_space(out);
+			}
+			write_text(out, text, len);
+			first = 0;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+	}
+
+	free(text);
+	return n == -1 ? -1 : 0;
+}
+
+void close_text(struct text *text) {
+	if (text->mapped) {
+		munmap((void *) text->bytes, text->len);
+	} else {
+		free((void *) text->bytes);
+	}
+	memset(text, '\0', sizeof(struct text));
+}
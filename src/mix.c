@@ -0,0 +1,441 @@
+ /*
+    mix.c - several stations at once for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "input.h"
+#include "mix.h"
+#include "sink.h"
+#include "synth.h"
+
+/* samples mixed at a time */
+#define MIX_BLOCK (RINGSIZE)
+
+/* a run of keyed samples straight from the tone and glyph caches, NULL for silence */
+struct span {
+	const int16_t *data;
+	size_t len;
+};
+
+struct voice {
+	struct synth synth;
+	struct output *out;
+	struct text text;
+	size_t next;
+
+	/* Q15 */
+	int16_t gain;
+
+	/* keyed but not yet mixed, oldest first from head */
+	struct span *spans;
+	size_t head;
+	size_t nspans;
+	size_t cap;
+	size_t queued;
+};
+
+/* white noise through a band pass biquad */
+struct noise {
+	uint64_t state;
+	double scale;
+	double b0, b2, a1, a2;
+	double x1, x2, y1, y2;
+	int16_t samples[MIX_BLOCK];
+};
+
+/* the ring is never used, segments carry everything */
+static void no_flush(struct output *out) {
+	(void) out;
+}
+
+/* segment hook: the cached samples stay put until exit_tone(), so only the pointer is kept */
+static void queue_span(struct output *out, const int16_t *data, size_t len) {
+	struct voice *voice = (struct voice *) out->data;
+	struct span *p = NULL;
+
+	if (voice->nspans == voice->cap && voice->head > 0) {
+		memmove(voice->spans, voice->spans + voice->head, (voice->nspans - voice->head) * sizeof(struct span));
+		voice->nspans -= voice->head;
+		voice->head = 0;
+	} else if (voice->nspans == voice->cap) {
+		voice->cap = voice->cap == 0 ? 64 : voice->cap * 2;
+		p = (struct span *) realloc(voice->spans, voice->cap * sizeof(struct span));
+		if (p == NULL) {
+			fprintf(stderr, "malloc failed :(\n");
+			exit(EXIT_FAILURE);
+		}
+		voice->spans = p;
+	}
+
+	voice->spans[voice->nspans].data = data;
+	voice->spans[voice->nspans].len = len;
+	voice->nspans++;
+	voice->queued += len;
+}
+
+/* key characters until there's at least n samples queued or the text runs out */
+static void fill_voice(struct voice *voice, size_t n) {
+	while (voice->queued < n && voice->next < voice->text.len) {
+		if (voice->next != 0) {
+			write_inter_character_space(voice->out);
+		}
+		write_character(voice->out, voice->text.bytes[voice->next++]);
+	}
+}
+
+/* acc[i] += src[i] * gain, saturating; the scalar tail rounds like the SIMD does */
+static void mix_samples(int16_t * restrict acc, const int16_t * restrict src, size_t n, int16_t gain) {
+	size_t i = 0;
+	int32_t v = 0;
+
+#ifdef __SSE2__
+	__m128i g = _mm_set1_epi16(gain);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i a = _mm_loadu_si128((const __m128i *) (acc + i));
+
+		/* full gain is added as is, so a lone voice comes out bit for bit */
+		if (gain != INT16_MAX) {
+			x = _mm_slli_epi16(_mm_mulhi_epi16(x, g), 1);
+		}
+		_mm_storeu_si128((__m128i *) (acc + i), _mm_adds_epi16(a, x));
+	}
+#endif
+
+	for (; i < n; i++) {
+		v = acc[i] + (gain == INT16_MAX ? src[i] : ((src[i] * gain) >> 16) * 2);
+		acc[i] = v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+	}
+}
+
+/* add the next n samples of voice, which is silent once its text is done */
+static void mix_voice(struct voice *voice, int16_t *acc, size_t n) {
+	struct span *span = NULL;
+	size_t off = 0;
+	size_t k = 0;
+
+	fill_voice(voice, n);
+
+	while (off < n && voice->head < voice->nspans) {
+		span = &voice->spans[voice->head];
+		k = span->len < n - off ? span->len : n - off;
+
+		/* silence costs nothing */
+		if (span->data != NULL) {
+			mix_samples(acc + off, span->data, k, voice->gain);
+			span->data += k;
+		}
+
+		span->len -= k;
+		voice->queued -= k;
+		off += k;
+
+		if (span->len == 0) {
+			voice->head++;
+		}
+	}
+}
+
+/* xorshift64*, to [-1, 1) */
+static double next_noise(struct noise *noise) {
+	noise->state ^= noise->state >> 12;
+	noise->state ^= noise->state << 25;
+	noise->state ^= noise->state >> 27;
+
+	return ((noise->state * 0x2545f4914f6cdd1dULL) >> 11) * (2.0 / 9007199254740992.0) - 1;
+}
+
+static double band_pass(struct noise *noise, double x) {
+	double y = noise->b0 * x + noise->b2 * noise->x2 - noise->a1 * noise->y1 - noise->a2 * noise->y2;
+
+	noise->x2 = noise->x1;
+	noise->x1 = x;
+	noise->y2 = noise->y1;
+	noise->y1 = y;
+
+	return y;
+}
+
+/*
+ * a constant peak gain band pass from NOISE_LOW to NOISE_HIGH, scaled so
+ * the noise's RMS is level percent of a voice's at full gain.
+ */
+static void init_noise(struct noise *noise, const struct synth *synth, int level) {
+	double f0 = sqrt((double) NOISE_LOW * NOISE_HIGH);
+	double w0 = 2 * M_PI * f0 / synth->sample_rate;
+	double alpha = sin(w0) * (NOISE_HIGH - NOISE_LOW) / (2 * f0);
+	double a0 = 1 + alpha;
+	double power = 0;
+	double y = 0;
+	size_t i;
+
+	memset(noise, '\0', sizeof(struct noise));
+
+	noise->b0 = alpha / a0;
+	noise->b2 = -alpha / a0;
+	noise->a1 = -2 * cos(w0) / a0;
+	noise->a2 = (1 - alpha) / a0;
+
+	/* the filter's power gain is the energy of its impulse response; uniform noise has 1/3 */
+	for (i = 0; i < (size_t) synth->sample_rate; i++) {
+		y = band_pass(noise, i == 0 ? 1 : 0);
+		power += y * y;
+	}
+
+	noise->x1 = noise->x2 = noise->y1 = noise->y2 = 0;
+	noise->state = synth->fist.seed * 2 + 1;
+	noise->scale = level / 100.0 * (volume / sqrt(2)) / sqrt(power / 3);
+}
+
+static void add_noise(struct noise *noise, int16_t *acc, size_t n) {
+	double y = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		y = band_pass(noise, next_noise(noise)) * noise->scale;
+		noise->samples[i] = y > INT16_MAX ? INT16_MAX : y < INT16_MIN ? INT16_MIN : (int16_t) y;
+	}
+
+	mix_samples(acc, noise->samples, n, INT16_MAX);
+}
+
+/* one NAME=VALUE field of a voice; -1 if it's not one we know or it's out of range */
+static int parse_field(struct voice *voice, char *field, size_t *start, int *follow) {
+	char *value = strchr(field, '=');
+	char *end = NULL;
+	long n = 0;
+
+	if (value == NULL) {
+		return -1;
+	}
+	*value++ = '\0';
+
+	n = strtol(value, &end, 10);
+	if (*value == '\0' || *end != '\0') {
+		/* no field takes a negative, so this fails them all */
+		n = -1;
+	}
+
+	if (strcmp(field, "wpm") == 0 && n >= 1 && n <= 100) {
+		voice->synth.wpm = n;
+	} else if (strcmp(field, "fwpm") == 0 && n >= 1 && n <= 100) {
+		voice->synth.fwpm = n;
+		*follow = 0;
+	} else if (strcmp(field, "tone") == 0 && n >= 60 && n <= 3000) {
+		voice->synth.frequency = n;
+	} else if (strcmp(field, "gain") == 0 && n >= 0 && n <= 100) {
+		voice->gain = n * INT16_MAX / 100;
+	} else if (strcmp(field, "start") == 0 && n >= 0) {
+		*start = n * voice->synth.sample_rate / 1000;
+	} else if (strcmp(field, "phase") == 0 && (n == 0 || n == 1)) {
+		voice->synth.phase_continuous = n;
+	} else if (strcmp(field, "weight") == 0 && n >= MIN_WEIGHT && n <= MAX_WEIGHT) {
+		voice->synth.fist.weight = n;
+	} else if (strcmp(field, "jitter") == 0 && n >= 0 && n <= MAX_JITTER) {
+		voice->synth.fist.jitter = n;
+	} else if (strcmp(field, "drift") == 0 && n >= 0 && n <= MAX_DRIFT) {
+		voice->synth.fist.drift = n;
+	} else if (strcmp(field, "seed") == 0 && n >= 0) {
+		voice->synth.fist.seed = n;
+	} else {
+		/* put the field back together for the error message */
+		value[-1] = '=';
+		return -1;
+	}
+
+	return 0;
+}
+
+/* set up a voice from a mix file line; returns its length in samples with its start, 0 on failure */
+static size_t open_voice(struct voice *voice, const struct synth *defaults, char *line, const char *mixfile, int lineno) {
+	char *path = NULL;
+	char *field = NULL;
+	char *save = NULL;
+	size_t start = 0;
+	int follow = defaults->fwpm == defaults->wpm;
+
+	memset(voice, '\0', sizeof(struct voice));
+	voice->synth = *defaults;
+	voice->synth.tones = NULL;
+	voice->gain = INT16_MAX;
+
+	path = strtok_r(line, " \t\r\n", &save);
+	for (field = strtok_r(NULL, " \t\r\n", &save); field != NULL; field = strtok_r(NULL, " \t\r\n", &save)) {
+		if (parse_field(voice, field, &start, &follow) == -1) {
+			fprintf(stderr, "%s:%d: bad field '%s'\n", mixfile, lineno, field);
+			return 0;
+		}
+	}
+
+	/* fwpm follows wpm, as on the command line, unless it's given or the defaults have their own */
+	if (follow) {
+		voice->synth.fwpm = voice->synth.wpm;
+	}
+
+	if (open_text(&voice->text, path) == -1) {
+		fprintf(stderr, "Could not open input file '%s'\n", path);
+		return 0;
+	}
+
+	init_space(&voice->synth);
+	if (init_tone(&voice->synth) == -1 || init_glyphs(&voice->synth, 0) == -1) {
+		fprintf(stderr, "Failed to initialize tones\n");
+		return 0;
+	}
+
+	voice->out = (struct output *) malloc(sizeof(struct output));
+	if (voice->out == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		return 0;
+	}
+	init_output(voice->out, &voice->synth, no_flush, voice);
+	voice->out->segment = queue_span;
+
+	write_silence(voice->out, start);
+
+	return start + measure_text(&voice->synth, voice->text.bytes, voice->text.len);
+}
+
+static void close_voice(struct voice *voice) {
+	exit_glyphs(&voice->synth);
+	exit_tone(&voice->synth);
+	exit_space(&voice->synth);
+
+	if (voice->text.bytes != NULL) {
+		close_text(&voice->text);
+	}
+
+	free(voice->spans);
+	free(voice->out);
+}
+
+int mix_voices(const struct synth *defaults, char *mixfile, const struct sink_type *type, char *filepath, int noise_level) {
+
+	FILE *mix = NULL;
+	struct voice *voices = NULL;
+	struct noise *noise = NULL;
+	struct synth synth;
+	struct output *out = NULL;
+	struct sink sink;
+	int16_t acc[MIX_BLOCK];
+	char line[8192];
+	char *p = NULL;
+	size_t nvoices = 0;
+	size_t total = 0;
+	size_t len = 0;
+	size_t done = 0;
+	size_t n = 0;
+	size_t i;
+	int lineno = 0;
+	int rc = 0;
+
+	voices = (struct voice *) calloc(MAX_VOICES, sizeof(struct voice));
+	noise = (struct noise *) malloc(sizeof(struct noise));
+	out = (struct output *) malloc(sizeof(struct output));
+	if (voices == NULL || noise == NULL || out == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+
+	mix = fopen(mixfile, "r");
+	if (mix == NULL) {
+		fprintf(stderr, "Could not open mix file '%s'\n", mixfile);
+		return -1;
+	}
+
+	/* one "INPUT.TXT [NAME=VALUE ...]" voice per line, blank lines and # comments ignored */
+	while (rc == 0 && fgets(line, sizeof(line), mix) != NULL) {
+		lineno++;
+
+		for (p = line; isspace((unsigned char) *p); p++) {
+			/* skip leading space */
+		}
+		if (*p == '\0' || *p == '#') {
+			continue;
+		}
+
+		if (nvoices == MAX_VOICES) {
+			fprintf(stderr, "%s:%d: more than %d voices\n", mixfile, lineno, MAX_VOICES);
+			rc = -1;
+			break;
+		}
+
+		len = open_voice(&voices[nvoices], defaults, p, mixfile, lineno);
+		nvoices++;
+		if (len == 0) {
+			rc = -1;
+		}
+		total = len > total ? len : total;
+	}
+	fclose(mix);
+
+	if (rc == 0 && nvoices == 0) {
+		fprintf(stderr, "%s: no voices\n", mixfile);
+		rc = -1;
+	}
+
+	if (rc == 0) {
+		/* only the output format matters to the sink */
+		synth = *defaults;
+		synth.tones = NULL;
+
+		init_noise(noise, &synth, noise_level);
+		init_sink(&sink, type, out, &synth, filepath, total);
+
+		/* each block is mixed in acc and gone after it's written, so it can't be handed over by reference */
+		out->segment = NULL;
+
+		for (done = 0; done < total; done += n) {
+			n = total - done < MIX_BLOCK ? total - done : MIX_BLOCK;
+
+			memset(acc, '\0', n * sizeof(int16_t));
+			for (i = 0; i < nvoices; i++) {
+				mix_voice(&voices[i], acc, n);
+			}
+			if (noise_level > 0) {
+				add_noise(noise, acc, n);
+			}
+
+			write_result(out, acc, n);
+		}
+
+		finish_sink(&sink, out);
+	}
+
+	for (i = 0; i < nvoices; i++) {
+		close_voice(&voices[i]);
+	}
+
+	free(voices);
+	free(noise);
+	free(out);
+
+	return rc;
+}
@@ -0,0 +1,402 @@
+ /*
+    normalize.c - input text to the characters morse_table knows
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "normalize.h"
+
+/* plain text for U+00A0 to U+017F, Latin-1 and Latin Extended-A */
+static const char *latin[] = {
+	/* U+00A0 */ " ", "!", "", "", "", "", "", "",
+	/* U+00A8 */ "", "(C)", "a", "\"", "", "", "(R)", "",
+	/* U+00B0 */ "", "+-", "2", "3", "'", "u", "", ".",
+	/* U+00B8 */ "", "1", "o", "\"", "1/4", "1/2", "3/4", "?",
+	/* U+00C0 */ "A", "A", "A", "A", "A", "A", "AE", "C",
+	/* U+00C8 */ "E", "E", "E", "E", "I", "I", "I", "I",
+	/* U+00D0 */ "D", "N", "O", "O", "O", "O", "O", "X",
+	/* U+00D8 */ "O", "U", "U", "U", "U", "Y", "TH", "ss",
+	/* U+00E0 */ "a", "a", "a", "a", "a", "a", "ae", "c",
+	/* U+00E8 */ "e", "e", "e", "e", "i", "i", "i", "i",
+	/* U+00F0 */ "d", "n", "o", "o", "o", "o", "o", "/",
+	/* U+00F8 */ "o", "u", "u", "u", "u", "y", "th", "y",
+	/* U+0100 */ "A", "a", "A", "a", "A", "a", "C", "c",
+	/* U+0108 */ "C", "c", "C", "c", "C", "c", "D", "d",
+	/* U+0110 */ "D", "d", "E", "e", "E", "e", "E", "e",
+	/* U+0118 */ "E", "e", "E", "e", "G", "g", "G", "g",
+	/* U+0120 */ "G", "g", "G", "g", "H", "h", "H", "h",
+	/* U+0128 */ "I", "i", "I", "i", "I", "i", "I", "i",
+	/* U+0130 */ "I", "i", "IJ", "ij", "J", "j", "K", "k",
+	/* U+0138 */ "q", "L", "l", "L", "l", "L", "l", "L",
+	/* U+0140 */ "l", "L", "l", "N", "n", "N", "n", "N",
+	/* U+0148 */ "n", "'n", "NG", "ng", "O", "o", "O", "o",
+	/* U+0150 */ "O", "o", "OE", "oe", "R", "r", "R", "r",
+	/* U+0158 */ "R", "r", "S", "s", "S", "s", "S", "s",
+	/* U+0160 */ "S", "s", "T", "t", "T", "t", "T", "t",
+	/* U+0168 */ "U", "u", "U", "u", "U", "u", "U", "u",
+	/* U+0170 */ "U", "u", "U", "u", "W", "w", "Y", "y",
+	/* U+0178 */ "Y", "Z", "z", "Z", "z", "Z", "z", "s"
+};
+
+/* plain text for U+2000 to U+206F, the general punctuation */
+static const char *punctuation[] = {
+	/* U+2000 */ " ", " ", " ", " ", " ", " ", " ", " ",
+	/* U+2008 */ " ", " ", " ", "", "", "", "", "",
+	/* U+2010 */ "-", "-", "-", "-", "-", "-", "", "",
+	/* U+2018 */ "'", "'", "'", "'", "\"", "\"", "\"", "\"",
+	/* U+2020 */ "", "", "", "", ".", "..", "...", "",
+	/* U+2028 */ " ", " ", "", "", "", "", "", " ",
+	/* U+2030 */ "", "", "'", "\"", "", "'", "\"", "",
+	/* U+2038 */ "", "'", "'", "", "!!", "", "", "",
+	/* U+2040 */ "", "", "", "-", "/", "", "", "??",
+	/* U+2048 */ "?!", "!?", "", "", "", "", "", "",
+	/* U+2050 */ "", "", "", "", "", "", "", "",
+	/* U+2058 */ "", "", "", "", "", "", "", " ",
+	/* U+2060 */ "", "", "", "", "", "", "", "",
+	/* U+2068 */ "", "", "", "", "", "", "", ""
+};
+
+/* Windows-1252's 0x80 to 0x9F, for bytes that aren't UTF-8 */
+static const char *cp1252[] = {
+	/* 0x80 */ "", "", "'", "f", "\"", "...", "", "",
+	/* 0x88 */ "", "", "S", "'", "OE", "", "Z", "",
+	/* 0x90 */ "", "'", "'", "\"", "\"", "", "-", "-",
+	/* 0x98 */ "", "TM", "s", "'", "oe", "", "z", "Y"
+};
+
+/* the prosigns, and the alphabet.inc slots that send them */
+static const struct {
+	const char name[4];
+	unsigned char c;
+} prosigns[] = {
+	{ "AA", 0xf8 },
+	{ "AR", '+' },
+	{ "AS", '&' },
+	{ "BK", 0xf9 },
+	{ "BT", '=' },
+	{ "CL", 0xfa },
+	{ "CT", 0xfb },
+	{ "HH", 0xfc },
+	{ "KA", 0xfb },
+	{ "KN", '(' },
+	{ "SK", 0xfd },
+	{ "SN", 0xfe },
+	{ "SOS", 0xff },
+	{ "VE", 0xfe }
+};
+
+void init_normalizer(struct normalizer *n) {
+	memset(n, '\0', sizeof(struct normalizer));
+}
+
+#ifdef __SSE2__
+/*
+ * a mask of the bytes in block that ordinary() stops at; sp carries
+ * whether the byte before it was a space or newline in lane 0 and comes
+ * back with the same for the next block.
+ */
+static inline __m128i special(__m128i block, __m128i *sp) {
+	__m128i nl = _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'));
+	__m128i spaces = _mm_or_si128(nl, _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')));
+	__m128i mask;
+
+	/* 9 to 13 wrap around to the bottom of the signed range; from 0x80 up is caught as it is */
+	mask = _mm_cmplt_epi8(_mm_add_epi8(block, _mm_set1_epi8(128 - 9)), _mm_set1_epi8(-128 + 5));
+	mask = _mm_or_si128(_mm_andnot_si128(nl, mask), _mm_cmpeq_epi8(block, _mm_set1_epi8('<')));
+	mask = _mm_or_si128(mask, _mm_and_si128(spaces, _mm_or_si128(_mm_slli_si128(spaces, 1), *sp)));
+	*sp = _mm_srli_si128(spaces, 15);
+
+	return _mm_or_si128(mask, block);
+}
+#endif
+
+/*
+ * how many bytes at the start of src are copied as they are, given
+ * whether the last character out was a space: ASCII that isn't '<',
+ * white space other than a space or a newline, or either of those
+ * following another.
+ */
+static size_t ordinary(const unsigned char *src, size_t len, int space) {
+	size_t i = 0;
+	unsigned char c = 0;
+
+#ifdef __SSE2__
+	__m128i sp = _mm_cvtsi32_si128(space ? 0xff : 0);
+	__m128i lo;
+	__m128i hi;
+	unsigned mask = 0;
+
+	/* two blocks at a time, the second only looked at closely when something's found */
+	for (; i + 32 <= len; i += 32) {
+		lo = special(_mm_loadu_si128((const __m128i *) (src + i)), &sp);
+		hi = special(_mm_loadu_si128((const __m128i *) (src + i + 16)), &sp);
+		mask = (unsigned) _mm_movemask_epi8(_mm_or_si128(lo, hi));
+		if (mask != 0) {
+			mask = (unsigned) _mm_movemask_epi8(lo) | (unsigned) _mm_movemask_epi8(hi) << 16;
+			return i + __builtin_ctz(mask);
+		}
+	}
+	space = _mm_cvtsi128_si32(sp) != 0;
+#endif
+
+	for (; i < len; i++) {
+		c = src[i];
+		if (c >= 0x80 || c == '<' || (c >= 9 && c <= 13 && c != '\n')) {
+			break;
+		} else if (c == ' ' || c == '\n') {
+			if (space) {
+				break;
+			}
+			space = 1;
+		} else {
+			space = 0;
+		}
+	}
+
+	return i;
+}
+
+/* copy the ordinary bytes at the start of src and return how many */
+static size_t copy(struct normalizer *n, unsigned char *dst, const unsigned char *src, size_t len) {
+	size_t k = ordinary(src, len, n->space);
+
+	if (k > 0) {
+		memcpy(dst, src, k);
+		n->space = src[k - 1] == ' ' || src[k - 1] == '\n';
+	}
+
+	return k;
+}
+
+/* write s, a space only if the last character out wasn't one */
+static size_t put(struct normalizer *n, unsigned char *dst, const char *s) {
+	size_t o = 0;
+
+	for (; *s != '\0'; s++) {
+		if (*s != ' ') {
+			dst[o++] = *s;
+			n->space = 0;
+		} else if (!n->space) {
+			dst[o++] = ' ';
+			n->space = 1;
+		}
+	}
+
+	return o;
+}
+
+static size_t put_codepoint(struct normalizer *n, unsigned char *dst, uint32_t cp) {
+	char ascii[2] = { '\0', '\0' };
+
+	if (cp >= 0xa0 && cp < 0x180) {
+		return put(n, dst, latin[cp - 0xa0]);
+	} else if (cp >= 0x2000 && cp < 0x2070) {
+		return put(n, dst, punctuation[cp - 0x2000]);
+	} else if (cp >= 0xff01 && cp <= 0xff5e) {
+		/* fullwidth forms of ASCII */
+		ascii[0] = (char) (cp - 0xfee0);
+		return put(n, dst, ascii);
+	}
+
+	switch (cp) {
+		case 0x1680:
+		case 0x3000:
+			return put(n, dst, " ");
+		case 0x2212:
+			return put(n, dst, "-");
+		default:
+			/* nothing to send it as, not even a gap */
+			return 0;
+	}
+}
+
+/*
+ * src[0] is '<': the length of the prosign there with *c set to send
+ * it, 0 if one may be cut off at the end of src, or 1 when it's just '<'.
+ */
+static size_t prosign(const unsigned char *src, size_t len, int more, unsigned char *c) {
+	char name[4];
+	size_t i;
+	size_t j;
+
+	for (j = 1; j < len && j < 5; j++) {
+		if (src[j] == '>') {
+			break;
+		} else if ((src[j] | 0x20) < 'a' || (src[j] | 0x20) > 'z') {
+			return 1;
+		}
+		name[j - 1] = src[j] & ~0x20;
+	}
+
+	if (j == 5) {
+		return 1;
+	} else if (j == len) {
+		return more ? 0 : 1;
+	} else if (j < 3) {
+		return 1;
+	}
+	name[j - 1] = '\0';
+
+	for (i = 0; i < sizeof(prosigns) / sizeof(prosigns[0]); i++) {
+		if (strcmp(prosigns[i].name, name) == 0) {
+			*c = prosigns[i].c;
+			return j + 1;
+		}
+	}
+
+	return 1;
+}
+
+/* the length of a valid UTF-8 sequence at the start of src, 0 if cut off, or -1 */
+static int utf8(const unsigned char *src, size_t len, int more, uint32_t *cp) {
+	unsigned char lo = 0x80;
+	unsigned char hi = 0xbf;
+	int need = 0;
+	int i;
+
+	if (src[0] >= 0xc2 && src[0] <= 0xdf) {
+		need = 2;
+		*cp = src[0] & 0x1f;
+	} else if (src[0] >= 0xe0 && src[0] <= 0xef) {
+		need = 3;
+		*cp = src[0] & 0x0f;
+		lo = src[0] == 0xe0 ? 0xa0 : 0x80;
+		hi = src[0] == 0xed ? 0x9f : 0xbf;
+	} else if (src[0] >= 0xf0 && src[0] <= 0xf4) {
+		need = 4;
+		*cp = src[0] & 0x07;
+		lo = src[0] == 0xf0 ? 0x90 : 0x80;
+		hi = src[0] == 0xf4 ? 0x8f : 0xbf;
+	} else {
+		return -1;
+	}
+
+	/* only the second byte's range depends on the first */
+	for (i = 1; i < need; i++) {
+		if ((size_t) i == len) {
+			return more ? 0 : -1;
+		} else if (src[i] < lo || src[i] > hi) {
+			return -1;
+		}
+		*cp = (*cp << 6) | (src[i] & 0x3f);
+		lo = 0x80;
+		hi = 0xbf;
+	}
+
+	return need;
+}
+
+/*
+ * convert the character at the start of src, one ordinary() stopped at,
+ * into dst at *o and return how many bytes it took; 0 when it's cut off
+ * and more may follow.
+ */
+static size_t convert(struct normalizer *n, unsigned char *dst, size_t *o, const unsigned char *src, size_t len, int more) {
+	unsigned char c = src[0];
+	uint32_t cp = 0;
+	size_t k = 0;
+	int seq = 0;
+
+	if (c == '<') {
+		k = prosign(src, len, more, &c);
+		if (k > 0) {
+			dst[(*o)++] = c;
+			n->space = 0;
+		}
+		return k;
+	} else if (c < 0x80) {
+		/* white space, or a space or newline after it */
+		*o += put(n, dst + *o, " ");
+		return 1;
+	}
+
+	seq = utf8(src, len, more, &cp);
+	if (seq > 0) {
+		*o += put_codepoint(n, dst + *o, cp);
+		return seq;
+	} else if (seq == 0) {
+		return 0;
+	}
+
+	/* not UTF-8: Windows-1252, which is Latin-1 from 0xA0 up */
+	*o += c < 0xa0 ? put(n, dst + *o, cp1252[c - 0x80]) : put_codepoint(n, dst + *o, c);
+	return 1;
+}
+
+size_t normalize(struct normalizer *n, unsigned char *dst, const unsigned char *src, size_t len, int final) {
+	unsigned char joined[NORMALIZE_HOLD * 2];
+	size_t nheld = n->nheld;
+	size_t take = len < NORMALIZE_HOLD ? len : NORMALIZE_HOLD;
+	size_t o = 0;
+	size_t i = 0;
+	size_t k = 0;
+
+	/* finish what the last block cut off with the start of this one */
+	n->nheld = 0;
+	if (nheld > 0) {
+		memcpy(joined, n->held, nheld);
+		memcpy(joined + nheld, src, take);
+
+		while (i < nheld) {
+			k = copy(n, dst + o, joined + i, nheld - i);
+			o += k;
+			i += k;
+			if (i == nheld) {
+				break;
+			}
+
+			k = convert(n, dst, &o, joined + i, nheld + take - i, !final && take == len);
+			if (k == 0) {
+				memcpy(n->held, joined + i, nheld + take - i);
+				n->nheld = nheld + take - i;
+				return o;
+			}
+			i += k;
+		}
+		i -= nheld;
+	}
+
+	while (i < len) {
+		k = copy(n, dst + o, src + i, len - i);
+		o += k;
+		i += k;
+		if (i == len) {
+			break;
+		}
+
+		k = convert(n, dst, &o, src + i, len - i, !final);
+		if (k == 0) {
+			memcpy(n->held, src + i, len - i);
+			n->nheld = len - i;
+			break;
+		}
+		i += k;
+	}
+
+	return o;
+}
+
+int is_normal(const unsigned char *text, size_t len) {
+	return ordinary(text, len, 0) == len;
+}
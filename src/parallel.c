@@ -0,0 +1,982 @@
+ /*
+    parallel.c - multithreaded encoding for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ * The input is cut into segments inside inter word spaces, at sample
+ * offsets that are a multiple of the FLAC block size. Every segment is
+ * synthesized and encoded by its own libFLAC instance, and since silence
+ * is identical wherever it is cut, each worker produces exactly the frames
+ * a single encoder would have, numbered from zero. The writer renumbers
+ * those frames, fixes up their CRCs and wraps them in one STREAMINFO and
+ * SEEKTABLE.
+ *
+ * The incremental mode cuts at the start of every word's gap instead, so
+ * a segment only depends on the text of its word and not where it lands.
+ * The cuts aren't block aligned, so the stream uses variable block sizes
+ * and frames are numbered by their first sample. Each word's frames are
+ * kept in a stash file keyed by its text, and only the words that aren't
+ * there are synthesized and encoded the next time.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <FLAC/stream_encoder.h>
+
+#include "encode.h"
+#include "input.h"
+#include "parallel.h"
+#include "progress.h"
+#include "stats.h"
+#include "synth.h"
+
+/* aim for a few segments per job so uneven segments still balance out */
+#define SEGMENTS_PER_JOB (4)
+#define MIN_SEGMENT_SAMPLES (1 << 20)
+#define SEEK_INTERVAL_SECONDS (10)
+
+#define STREAMINFO_LEN (34)
+#define SEEKPOINT_LEN (18)
+
+/* first line of a stash file, then the settings it was made with */
+#define STASH_MAGIC "text-to-morse stash 2\n"
+#define STASH_SETTINGS_LEN (256)
+
+#define FNV_OFFSET (0xcbf29ce484222325ULL)
+#define FNV_PRIME (0x100000001b3ULL)
+
+struct segment {
+	/* the first input character rendered and how much of its leading silence to drop, and the end of its text */
+	size_t first;
+	size_t skip;
+	size_t end;
+
+	/* sample number of the first sample and the number of samples */
+	size_t start;
+	size_t nsamples;
+
+	/* where the timeline is at the gap before first, skip samples before start */
+	struct timeline timeline;
+
+	/* encoded frames, back to back, and where each one ends */
+	unsigned char *bytes;
+	size_t len;
+	size_t cap;
+	size_t *frames;
+	size_t nframes;
+	size_t frames_cap;
+
+	/* what the incremental mode stashes it by, and whether its frames came from there */
+	unsigned char *key;
+	size_t key_len;
+	int stashed;
+	int done;
+};
+
+struct pool {
+	struct synth *synth;
+	const unsigned char *text;
+	size_t text_len;
+
+	struct segment *segments;
+	size_t nsegments;
+	size_t segments_cap;
+
+	/* the block size, and whether segments are cut off the block grid */
+	unsigned blocksize;
+	int variable;
+
+	/* where the incremental mode keeps every segment for next time, NULL otherwise */
+	FILE *stash;
+
+	/* next segment to hand out, segments written so far, and how far ahead of the writer the workers may get */
+	size_t next;
+	size_t written;
+	size_t window;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void *xrealloc(void *p, size_t len) {
+	STATS_ADD(STATS_REALLOCS, p != NULL);
+	p = realloc(p, len);
+	if (p == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static struct segment *add_segment(struct pool *pool, size_t first, const struct timeline *timeline, size_t skip, size_t start) {
+	struct segment *seg = NULL;
+
+	/* doubled, --incremental makes one per word */
+	if (pool->nsegments == pool->segments_cap) {
+		pool->segments_cap = pool->segments_cap == 0 ? 64 : pool->segments_cap * 2;
+		pool->segments = (struct segment *) xrealloc(pool->segments, pool->segments_cap * sizeof(struct segment));
+	}
+	seg = &pool->segments[pool->nsegments++];
+	memset(seg, '\0', sizeof(struct segment));
+
+	seg->first = first;
+	seg->timeline = *timeline;
+	seg->skip = skip;
+	seg->start = start;
+
+	return seg;
+}
+
+/* find the cut points: block aligned sample offsets inside word spaces */
+static void plan_segments(struct pool *pool, size_t total, size_t blocksize, int jobs) {
+
+	struct segment *seg = NULL;
+	struct timeline timeline;
+	struct timeline before;
+	size_t target = 0;
+	size_t pos = 0;
+	size_t span = 0;
+	size_t cut = 0;
+	size_t i;
+
+	target = total / (jobs * SEGMENTS_PER_JOB);
+	target = target < MIN_SEGMENT_SAMPLES ? MIN_SEGMENT_SAMPLES : target;
+
+	memset(&timeline, '\0', sizeof(timeline));
+	seg = add_segment(pool, 0, &timeline, 0, 0);
+
+	for (i = 0; i < pool->text_len; i++) {
+		before = timeline;
+		span = pos;
+		if (i != 0) {
+			advance_inter_character_space(pool->synth, &timeline);
+		}
+		advance_character(pool->synth, &timeline, pool->text[i]);
+		pos = timeline_position(pool->synth, &timeline);
+
+		/* a word space and the inter character space before it are all silence */
+		if (is_word_space(pool->text[i]) && pos - seg->start >= target) {
+			cut = pos / blocksize * blocksize;
+			if (cut >= span && cut > seg->start && cut < total) {
+				seg->nsamples = cut - seg->start;
+				seg->end = i;
+				seg = add_segment(pool, i, &before, cut - span, cut);
+			}
+		}
+	}
+
+	seg->nsamples = total - seg->start;
+	seg->end = pool->text_len;
+}
+
+/* a segment per word, cut where the gap before it starts */
+static void plan_words(struct pool *pool, size_t total, size_t blocksize) {
+
+	struct segment *seg = NULL;
+	struct timeline timeline;
+	struct timeline before;
+	size_t pos = 0;
+	size_t span = 0;
+	size_t cut = 0;
+	size_t i;
+
+	memset(&timeline, '\0', sizeof(timeline));
+	seg = add_segment(pool, 0, &timeline, 0, 0);
+
+	for (i = 0; i < pool->text_len; i++) {
+		before = timeline;
+		span = pos;
+		if (i != 0) {
+			advance_inter_character_space(pool->synth, &timeline);
+		}
+		advance_character(pool->synth, &timeline, pool->text[i]);
+		pos = timeline_position(pool->synth, &timeline);
+
+		if (i != 0 && is_word_space(pool->text[i]) && span > seg->start) {
+			cut = span;
+
+			/*
+			 * only the last frame of the stream may be shorter than that, so
+			 * move into the gap until the segment's last frame is long enough;
+			 * if the gap ends first the word isn't cut from the one before
+			 */
+			if ((cut - seg->start) % blocksize != 0 && (cut - seg->start) % blocksize < MIN_BLOCKSIZE) {
+				cut += MIN_BLOCKSIZE - (cut - seg->start) % blocksize;
+			}
+
+			if (cut < pos && cut < total) {
+				seg->nsamples = cut - seg->start;
+				seg->end = i;
+				seg = add_segment(pool, i, &before, cut - span, cut);
+			}
+		}
+	}
+
+	seg->nsamples = total - seg->start;
+	seg->end = pool->text_len;
+}
+
+static FLAC__StreamEncoderWriteStatus capture_frame(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, uint32_t samples, uint32_t current_frame, void *client_data) {
+
+	struct segment *seg = (struct segment *) client_data;
+
+	(void) encoder;
+	(void) current_frame;
+
+	/* metadata is written by the stitcher, keep only the frames */
+	if (samples == 0) {
+		return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+	}
+
+	if (seg->len + bytes > seg->cap) {
+		seg->cap = seg->cap == 0 ? 65536 : seg->cap;
+		while (seg->len + bytes > seg->cap) {
+			seg->cap *= 2;
+		}
+		seg->bytes = (unsigned char *) xrealloc(seg->bytes, seg->cap);
+		STATS_PEAK(STATS_PEAK_BUFFER, seg->cap);
+	}
+
+	if (seg->nframes == seg->frames_cap) {
+		seg->frames_cap = seg->frames_cap == 0 ? 64 : seg->frames_cap * 2;
+		seg->frames = (size_t *) xrealloc(seg->frames, seg->frames_cap * sizeof(size_t));
+	}
+
+	memcpy(seg->bytes + seg->len, buffer, bytes);
+	seg->len += bytes;
+	seg->frames[seg->nframes++] = seg->len;
+
+	return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+static void encode_segment(struct pool *pool, struct segment *seg, FLAC__StreamEncoder *encoder, struct output *out) {
+
+	FLAC__bool ok = true;
+	FLAC__StreamEncoderInitStatus init_status;
+	size_t i;
+	STATS_CLOCK(start);
+
+	ok &= setup_encoder(encoder, pool->synth, seg->nsamples);
+	if (ok) {
+		init_status = FLAC__stream_encoder_init_stream(encoder, capture_frame, NULL, NULL, NULL, seg);
+		if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+			fprintf(stderr, "ERROR: initializing encoder: %s\n", FLAC__StreamEncoderInitStatusString[init_status]);
+			ok = false;
+		}
+	}
+
+	if (!ok) {
+		exit(EXIT_FAILURE);
+	}
+
+	init_output(out, pool->synth, encode_output, encoder);
+	out->skip = seg->skip;
+	out->limit = seg->nsamples;
+	out->position = seg->start - seg->skip;
+	out->timeline = seg->timeline;
+
+	STATS_RESTART(start);
+	for (i = seg->first; i < pool->text_len && out->total_samples < seg->nsamples; i++) {
+		if (i != 0) {
+			write_inter_character_space(out);
+		}
+		write_character(out, pool->text[i]);
+	}
+	STATS_ADD(STATS_CHARACTERS, i - seg->first);
+
+	flush_output(out);
+	STATS_TIME(STATS_RENDER, start);
+
+	STATS_RESTART(start);
+	if (!FLAC__stream_encoder_finish(encoder)) {
+		fprintf(stderr, "ERROR: encoding: %s\n", FLAC__StreamEncoderStateString[FLAC__stream_encoder_get_state(encoder)]);
+		exit(EXIT_FAILURE);
+	}
+	STATS_TIME(STATS_CLOSE, start);
+}
+
+static void *work(void *arg) {
+
+	struct pool *pool = (struct pool *) arg;
+	FLAC__StreamEncoder *encoder = NULL;
+	struct output *out = NULL;
+	size_t k = 0;
+
+	if ((encoder = FLAC__stream_encoder_new()) == NULL) {
+		fprintf(stderr, "ERROR: allocating encoder\n");
+		exit(EXIT_FAILURE);
+	}
+
+	out = (struct output *) xrealloc(NULL, sizeof(struct output));
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->next < pool->nsegments && pool->next >= pool->written + pool->window) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		if (pool->next == pool->nsegments) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		k = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		/* already done before the workers started */
+		if (pool->segments[k].stashed) {
+			continue;
+		}
+
+		encode_segment(pool, &pool->segments[k], encoder, out);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->segments[k].done = 1;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	free(out);
+	FLAC__stream_encoder_delete(encoder);
+
+	return NULL;
+}
+
+/* frame header and frame CRCs, MSB first as defined by the FLAC format */
+static uint16_t crc16_table[256];
+
+static void init_crc16(void) {
+	unsigned crc;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		crc = i << 8;
+		for (k = 0; k < 8; k++) {
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x8005) & 0xffff : (crc << 1) & 0xffff;
+		}
+		crc16_table[i] = crc;
+	}
+}
+
+static unsigned crc16(const unsigned char *p, size_t len) {
+	unsigned crc = 0;
+
+	while (len-- > 0) {
+		crc = ((crc << 8) ^ crc16_table[(crc >> 8) ^ *p++]) & 0xffff;
+	}
+
+	return crc;
+}
+
+static unsigned crc8(const unsigned char *p, size_t len) {
+	unsigned crc = 0;
+	int k;
+
+	while (len-- > 0) {
+		crc ^= *p++;
+		for (k = 0; k < 8; k++) {
+			crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) & 0xff : (crc << 1) & 0xff;
+		}
+	}
+
+	return crc;
+}
+
+/* the frame number is stored with the same variable length coding as UTF-8 */
+static size_t put_utf8(unsigned char *p, uint64_t v) {
+	size_t n, i;
+
+	if (v < 0x80) {
+		p[0] = v;
+		return 1;
+	}
+
+	for (n = 2; n < 7 && v >= ((uint64_t) 1 << (5 * n + 1)); n++) {
+		/* find the number of bytes needed */
+	}
+
+	for (i = n - 1; i > 0; i--) {
+		p[i] = 0x80 | (v & 0x3f);
+		v >>= 6;
+	}
+	p[0] = (0xff << (8 - n)) | v;
+
+	return n;
+}
+
+static size_t utf8_len(unsigned char c) {
+	size_t n = 0;
+
+	while (n < 8 && (c & (0x80 >> n))) {
+		n++;
+	}
+
+	return n == 0 ? 1 : n;
+}
+
+/* copy a frame into dst with a new frame number, or first sample number when variable, returns the new length */
+static size_t renumber_frame(unsigned char *dst, const unsigned char *src, size_t len, uint64_t number, int variable) {
+
+	size_t in = 4;
+	size_t out = 4;
+	size_t extra = 0;
+	unsigned crc;
+
+	memcpy(dst, src, 4);
+	dst[1] = (src[1] & 0xfe) | (variable ? 1 : 0);
+	in += utf8_len(src[4]);
+	out += put_utf8(dst + 4, number);
+
+	/* block size and sample rate stored at the end of the header */
+	extra += (src[2] >> 4) == 6 ? 1 : (src[2] >> 4) == 7 ? 2 : 0;
+	extra += (src[2] & 0x0f) == 12 ? 1 : (src[2] & 0x0f) >= 13 && (src[2] & 0x0f) <= 14 ? 2 : 0;
+
+	memcpy(dst + out, src + in, extra);
+	in += extra;
+	out += extra;
+
+	dst[out] = crc8(dst, out);
+	in++;
+	out++;
+
+	memcpy(dst + out, src + in, len - in - 2);
+	out += len - in - 2;
+
+	crc = crc16(dst, out);
+	dst[out++] = crc >> 8;
+	dst[out++] = crc & 0xff;
+
+	return out;
+}
+
+static void put_be(unsigned char *p, uint64_t v, size_t n) {
+	while (n-- > 0) {
+		p[n] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+static void put_streaminfo(unsigned char *p, const struct synth *synth, unsigned min_block, unsigned max_block, size_t min_frame, size_t max_frame, uint64_t total) {
+	memset(p, '\0', STREAMINFO_LEN);
+
+	put_be(p, min_block, 2);
+	put_be(p + 2, max_block, 2);
+	put_be(p + 4, min_frame, 3);
+	put_be(p + 7, max_frame, 3);
+
+	/* 20 bits sample rate, 3 bits channels-1, 5 bits bps-1, 36 bits total samples */
+	put_be(p + 10, ((uint64_t) synth->sample_rate << 44) | ((uint64_t) (channels - 1) << 41) |
+			((uint64_t) (synth->bps - 1) << 36) | (total & 0xfffffffffULL), 8);
+
+	/* the MD5 signature is left unset, the segments are hashed separately */
+}
+
+static void put_seekpoint(unsigned char *p, uint64_t sample, uint64_t offset, unsigned samples) {
+	put_be(p, sample, 8);
+	put_be(p + 8, offset, 8);
+	put_be(p + 16, samples, 2);
+}
+
+static void write_bytes(FILE *out, const void *p, size_t len) {
+	if (fwrite(p, 1, len, out) != len) {
+		fprintf(stderr, "ERROR: writing output\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* the block size a single encoder would use with these settings */
+static unsigned encoder_blocksize(const struct synth *synth) {
+	FLAC__StreamEncoder *encoder = NULL;
+	unsigned blocksize = 0;
+
+	if ((encoder = FLAC__stream_encoder_new()) == NULL) {
+		fprintf(stderr, "ERROR: allocating encoder\n");
+		exit(EXIT_FAILURE);
+	}
+	setup_encoder(encoder, synth, 0);
+	blocksize = FLAC__stream_encoder_get_blocksize(encoder);
+	FLAC__stream_encoder_delete(encoder);
+
+	return blocksize;
+}
+
+static void init_pool(struct pool *pool, struct synth *synth, const struct text *text, int jobs) {
+	init_crc16();
+
+	memset(pool, '\0', sizeof(struct pool));
+	pool->synth = synth;
+	pool->text = text->bytes;
+	pool->text_len = text->len;
+	pool->window = jobs * 2;
+	pool->blocksize = encoder_blocksize(synth);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+}
+
+static void stash_segment(struct pool *pool, struct segment *seg);
+
+/* encode the planned segments on jobs threads and write them out in order as one stream */
+static void stitch(struct pool *pool, char *filepath, size_t total, int jobs) {
+
+	pthread_t threads[MAX_JOBS];
+	FILE *out = NULL;
+	unsigned char header[8 + STREAMINFO_LEN + 4];
+	unsigned char *seektable = NULL;
+	unsigned char *frame = NULL;
+	size_t frame_cap = 0;
+	size_t npoints = 0;
+	size_t point = 0;
+	size_t interval = 0;
+	size_t min_frame = SIZE_MAX;
+	size_t max_frame = 0;
+	uint64_t offset = 0;
+	uint64_t sample = 0;
+	unsigned blocksize = pool->blocksize;
+	unsigned min_block = blocksize;
+	size_t k, f, n, begin, len;
+	int seekable = 0;
+	int i;
+
+	seekable = strcmp(filepath, "-") != 0;
+	out = seekable ? fopen(filepath, "wb") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "ERROR: could not open output file '%s'\n", filepath);
+		exit(EXIT_FAILURE);
+	}
+
+	/* the seek table gets a point every few seconds, filled in as frames are written */
+	interval = SEEK_INTERVAL_SECONDS * pool->synth->sample_rate;
+	npoints = total == 0 || !seekable ? 0 : (total - 1) / interval + 1;
+	seektable = (unsigned char *) xrealloc(NULL, npoints * SEEKPOINT_LEN + 1);
+
+	memcpy(header, "fLaC", 4);
+	header[4] = npoints == 0 ? 0x80 : 0x00;
+	put_be(header + 5, STREAMINFO_LEN, 3);
+	put_streaminfo(header + 8, pool->synth, blocksize, blocksize, 0, 0, total);
+	header[8 + STREAMINFO_LEN] = 0x80 | 3;
+	put_be(header + 8 + STREAMINFO_LEN + 1, npoints * SEEKPOINT_LEN, 3);
+	write_bytes(out, header, npoints == 0 ? 8 + STREAMINFO_LEN : sizeof(header));
+	write_bytes(out, seektable, npoints * SEEKPOINT_LEN);
+	progress_wrote(0, 0, (npoints == 0 ? 8 + STREAMINFO_LEN : sizeof(header)) + npoints * SEEKPOINT_LEN);
+
+	for (i = 0; i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, work, pool) != 0) {
+			fprintf(stderr, "ERROR: starting worker thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (k = 0; k < pool->nsegments; k++) {
+		struct segment *seg = &pool->segments[k];
+
+		pthread_mutex_lock(&pool->lock);
+		while (!seg->done) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		if (!pool->variable && seg->start % blocksize != 0) {
+			fprintf(stderr, "ERROR: segment %lu is not block aligned\n", (unsigned long) k);
+			exit(EXIT_FAILURE);
+		}
+
+		sample = seg->start;
+		for (f = 0, begin = 0; f < seg->nframes; f++, begin = seg->frames[f - 1]) {
+			/* every frame is a whole block but the segment's last */
+			n = seg->start + seg->nsamples - sample;
+			n = n < blocksize ? n : blocksize;
+
+			len = seg->frames[f] - begin;
+			if (len + 8 > frame_cap) {
+				frame_cap = (len + 8) * 2;
+				frame = (unsigned char *) xrealloc(frame, frame_cap);
+			}
+			len = renumber_frame(frame, seg->bytes + begin, len, pool->variable ? sample : sample / blocksize, pool->variable);
+
+			/* every seek point that lands in this frame points at its start */
+			while (point < npoints && point * interval < sample + n && point * interval < total) {
+				put_seekpoint(seektable + point * SEEKPOINT_LEN, sample, offset, n);
+				point++;
+			}
+
+			write_bytes(out, frame, len);
+			progress_wrote(n, 1, len);
+			offset += len;
+			sample += n;
+			min_frame = len < min_frame ? len : min_frame;
+			max_frame = len > max_frame ? len : max_frame;
+			min_block = sample < total && n < min_block ? n : min_block;
+		}
+
+		if (!seekable && fflush(out) != 0) {
+			fprintf(stderr, "ERROR: writing output\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (pool->stash != NULL) {
+			stash_segment(pool, seg);
+		}
+
+		free(seg->bytes);
+		free(seg->frames);
+		seg->bytes = NULL;
+		seg->frames = NULL;
+
+		pthread_mutex_lock(&pool->lock);
+		pool->written++;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	for (i = 0; i < jobs; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	STATS_ADD(STATS_OUTPUTS, 1);
+	STATS_ADD(STATS_SAMPLES, total);
+	STATS_ADD(STATS_OUTPUT_BYTES, (npoints == 0 ? 8 + STREAMINFO_LEN : sizeof(header)) + npoints * SEEKPOINT_LEN + offset);
+
+	/* fill in the frame sizes and the seek table now that they are known */
+	if (seekable) {
+		put_streaminfo(header + 8, pool->synth, min_block, blocksize, min_frame == SIZE_MAX ? 0 : min_frame, max_frame, total);
+		if (fseek(out, 8, SEEK_SET) != 0) {
+			fprintf(stderr, "ERROR: output is not seekable\n");
+			exit(EXIT_FAILURE);
+		}
+		write_bytes(out, header + 8, STREAMINFO_LEN);
+		if (npoints > 0) {
+			fseek(out, 8 + STREAMINFO_LEN + 4, SEEK_SET);
+			write_bytes(out, seektable, npoints * SEEKPOINT_LEN);
+		}
+	}
+
+	if ((seekable ? fclose(out) : fflush(out)) != 0) {
+		fprintf(stderr, "ERROR: writing output\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stderr, "encoding: succeeded\n");
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+	free(seektable);
+	free(frame);
+}
+
+void encode_parallel(struct synth *synth, const struct text *text, char *filepath, int jobs) {
+
+	struct pool pool;
+	size_t total = 0;
+
+	init_pool(&pool, synth, text, jobs);
+
+	total = measure_text(synth, pool.text, pool.text_len);
+	plan_segments(&pool, total, pool.blocksize, jobs);
+
+	stitch(&pool, filepath, total, jobs);
+
+	free(pool.segments);
+}
+
+/*
+ * A stash file is STASH_MAGIC, a line of the settings it was made with,
+ * then an entry per segment, all numbers big endian:
+ *
+ *     key length (4), key, samples (8), frames (4), frame ends (4 each), frames
+ *
+ * and a key is the skip (8), the start for a continuous phase and 0
+ * otherwise (8), how far into a sample the word starts in ticks (8), 1
+ * for the first segment and 0 otherwise (1), the text length (4) and the
+ * text.
+ */
+struct stash {
+	unsigned char *data;
+	size_t len;
+
+	/* open addressing on the hash of the key, entries by where they start */
+	const unsigned char **slots;
+	size_t nslots;
+};
+
+struct stashed {
+	const unsigned char *key;
+	size_t key_len;
+	size_t nsamples;
+	size_t nframes;
+	const unsigned char *ends;
+	const unsigned char *bytes;
+	size_t len;
+};
+
+static uint64_t get_be(const unsigned char *p, size_t n) {
+	uint64_t v = 0;
+
+	while (n-- > 0) {
+		v = (v << 8) | *p++;
+	}
+
+	return v;
+}
+
+static uint64_t fnv(const unsigned char *p, size_t len) {
+	uint64_t h = FNV_OFFSET;
+
+	while (len-- > 0) {
+		h = (h ^ *p++) * FNV_PRIME;
+	}
+
+	return h;
+}
+
+/* everything else the frames depend on; a stash made with other settings is ignored */
+static void stash_settings(char *settings, const struct synth *synth, unsigned blocksize) {
+	snprintf(settings, STASH_SETTINGS_LEN, "wpm=%d fwpm=%d tone=%.17g rate=%.17g bits=%d phase=%d level=%d blocksize=%u apodization=%s\n",
+		synth->wpm, synth->fwpm, synth->frequency, synth->sample_rate, synth->bps, synth->phase_continuous,
+		compression_level, blocksize, flac_apodization == NULL ? "" : flac_apodization);
+}
+
+/* what a segment's samples depend on, kept with it for the stash */
+static void make_key(struct pool *pool, struct segment *seg) {
+	size_t len = seg->end - seg->first;
+
+	seg->key_len = 8 + 8 + 8 + 1 + 4 + len;
+	seg->key = (unsigned char *) xrealloc(NULL, seg->key_len);
+
+	/* edges round the same way wherever the word lands, as long as it starts as far into a sample */
+	put_be(seg->key, seg->skip, 8);
+	put_be(seg->key + 8, pool->synth->phase_continuous ? seg->start : 0, 8);
+	put_be(seg->key + 16, seg->timeline.ticks % pool->synth->sample_ticks, 8);
+	seg->key[24] = seg->first == 0;
+	put_be(seg->key + 25, len, 4);
+	memcpy(seg->key + 29, pool->text + seg->first, len);
+}
+
+/* the entry at p, or -1 if it's cut short or doesn't add up */
+static int parse_stashed(struct stashed *e, const unsigned char *p, const unsigned char *end, const unsigned char **next) {
+	size_t f;
+
+	if (end - p < 4) {
+		return -1;
+	}
+	e->key_len = get_be(p, 4);
+	e->key = p + 4;
+	p += 4 + e->key_len;
+
+	if (e->key_len > (size_t) (end - e->key) || end - p < 12) {
+		return -1;
+	}
+	e->nsamples = get_be(p, 8);
+	e->nframes = get_be(p + 8, 4);
+	e->ends = p + 12;
+	p += 12;
+
+	if (e->nframes > (size_t) (end - p) / 4) {
+		return -1;
+	}
+	p += 4 * e->nframes;
+
+	/* the ends have to go up, and the last is the length of the frames */
+	e->len = 0;
+	for (f = 0; f < e->nframes; f++) {
+		if (get_be(e->ends + 4 * f, 4) <= e->len) {
+			return -1;
+		}
+		e->len = get_be(e->ends + 4 * f, 4);
+	}
+	if (e->len > (size_t) (end - p)) {
+		return -1;
+	}
+	e->bytes = p;
+
+	*next = p + e->len;
+	return 0;
+}
+
+static void load_stash(struct stash *stash, const char *path, const char *settings) {
+	struct stashed e;
+	FILE *in = NULL;
+	const unsigned char *p = NULL;
+	const unsigned char *end = NULL;
+	const unsigned char *next = NULL;
+	size_t header = strlen(STASH_MAGIC) + strlen(settings);
+	size_t cap = 0;
+	size_t count = 0;
+	size_t n = 0;
+	size_t h;
+
+	memset(stash, '\0', sizeof(struct stash));
+
+	/* no stash yet is the same as an empty one */
+	in = fopen(path, "rb");
+	if (in == NULL) {
+		return;
+	}
+
+	do {
+		if (stash->len == cap) {
+			cap = cap == 0 ? 65536 : cap * 2;
+			stash->data = (unsigned char *) xrealloc(stash->data, cap);
+		}
+		n = fread(stash->data + stash->len, 1, cap - stash->len, in);
+		stash->len += n;
+	} while (n > 0);
+	fclose(in);
+
+	if (stash->len < header || memcmp(stash->data, STASH_MAGIC, strlen(STASH_MAGIC)) != 0 ||
+			memcmp(stash->data + strlen(STASH_MAGIC), settings, strlen(settings)) != 0) {
+		stash->len = 0;
+		return;
+	}
+
+	end = stash->data + stash->len;
+	for (p = stash->data + header; p < end && parse_stashed(&e, p, end, &next) == 0; p = next) {
+		count++;
+	}
+
+	for (stash->nslots = 64; stash->nslots < count * 2; stash->nslots *= 2) {
+		/* find a power of two with room to spare */
+	}
+	stash->slots = (const unsigned char **) xrealloc(NULL, stash->nslots * sizeof(const unsigned char *));
+	memset(stash->slots, '\0', stash->nslots * sizeof(const unsigned char *));
+
+	/* anything after an entry that doesn't add up is dropped */
+	for (p = stash->data + header; count-- > 0; p = next) {
+		parse_stashed(&e, p, end, &next);
+		for (h = fnv(e.key, e.key_len) & (stash->nslots - 1); stash->slots[h] != NULL; h = (h + 1) & (stash->nslots - 1)) {
+			/* probe */
+		}
+		stash->slots[h] = p;
+	}
+}
+
+static int find_stashed(const struct stash *stash, const unsigned char *key, size_t key_len, struct stashed *e) {
+	const unsigned char *next = NULL;
+	size_t h;
+
+	if (stash->nslots == 0) {
+		return 0;
+	}
+
+	for (h = fnv(key, key_len) & (stash->nslots - 1); stash->slots[h] != NULL; h = (h + 1) & (stash->nslots - 1)) {
+		parse_stashed(e, stash->slots[h], stash->data + stash->len, &next);
+		if (e->key_len == key_len && memcmp(e->key, key, key_len) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void free_stash(struct stash *stash) {
+	free(stash->data);
+	free(stash->slots);
+}
+
+/* called by the writer with each segment, in order, before its frames are freed */
+static void stash_segment(struct pool *pool, struct segment *seg) {
+	unsigned char n[12];
+	size_t f;
+
+	put_be(n, seg->key_len, 4);
+	write_bytes(pool->stash, n, 4);
+	write_bytes(pool->stash, seg->key, seg->key_len);
+
+	put_be(n, seg->nsamples, 8);
+	put_be(n + 8, seg->nframes, 4);
+	write_bytes(pool->stash, n, 12);
+
+	for (f = 0; f < seg->nframes; f++) {
+		put_be(n, seg->frames[f], 4);
+		write_bytes(pool->stash, n, 4);
+	}
+	write_bytes(pool->stash, seg->bytes, seg->len);
+
+	free(seg->key);
+	seg->key = NULL;
+}
+
+void encode_incremental(struct synth *synth, const struct text *text, char *filepath, const char *stashpath, int jobs) {
+
+	struct pool pool;
+	struct stash stash;
+	struct stashed e;
+	char settings[STASH_SETTINGS_LEN];
+	char *tmppath = NULL;
+	size_t total = 0;
+	size_t reused = 0;
+	size_t k, f;
+
+	init_pool(&pool, synth, text, jobs);
+	pool.variable = 1;
+
+	total = measure_text(synth, pool.text, pool.text_len);
+	plan_words(&pool, total, pool.blocksize);
+
+	stash_settings(settings, synth, pool.blocksize);
+	load_stash(&stash, stashpath, settings);
+
+	/* words seen last time are done before the workers start */
+	for (k = 0; k < pool.nsegments; k++) {
+		struct segment *seg = &pool.segments[k];
+
+		make_key(&pool, seg);
+		if (!find_stashed(&stash, seg->key, seg->key_len, &e) || e.nsamples != seg->nsamples) {
+			continue;
+		}
+
+		seg->bytes = (unsigned char *) xrealloc(NULL, e.len);
+		seg->frames = (size_t *) xrealloc(NULL, e.nframes * sizeof(size_t) + 1);
+		memcpy(seg->bytes, e.bytes, e.len);
+		for (f = 0; f < e.nframes; f++) {
+			seg->frames[f] = get_be(e.ends + 4 * f, 4);
+		}
+		seg->len = e.len;
+		seg->nframes = e.nframes;
+		seg->stashed = 1;
+		seg->done = 1;
+		reused++;
+	}
+	free_stash(&stash);
+
+	fprintf(stderr, "incremental: %lu of %lu words from the stash\n", (unsigned long) reused, (unsigned long) pool.nsegments);
+
+	/* the new stash has just this text's words, and replaces the old one once it's all there */
+	tmppath = (char *) xrealloc(NULL, strlen(stashpath) + 5);
+	sprintf(tmppath, "%s.tmp", stashpath);
+
+	pool.stash = fopen(tmppath, "wb");
+	if (pool.stash == NULL) {
+		fprintf(stderr, "ERROR: could not open stash file '%s'\n", tmppath);
+		exit(EXIT_FAILURE);
+	}
+	write_bytes(pool.stash, STASH_MAGIC, strlen(STASH_MAGIC));
+	write_bytes(pool.stash, settings, strlen(settings));
+
+	stitch(&pool, filepath, total, jobs);
+
+	if (fclose(pool.stash) != 0 || rename(tmppath, stashpath) != 0) {
+		fprintf(stderr, "ERROR: writing stash file '%s'\n", stashpath);
+		exit(EXIT_FAILURE);
+	}
+
+	free(tmppath);
+	free(pool.segments);
+}
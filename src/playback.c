@@ -0,0 +1,234 @@
+ /*
+    playback.c - real-time output for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "playback.h"
+#include "sink.h"
+#include "synth.h"
+
+#define KEYS_READSIZE (256)
+
+/* ^D ends a session; the terminal isn't in canonical mode, so it arrives as a byte */
+#define END_OF_SESSION (0x04)
+
+struct player {
+	int fd;
+	unsigned char samples[PLAYBACK_PERIOD * 3];
+
+	/* clock time of the first sample and the number of samples written since */
+	struct timespec start;
+	size_t written;
+};
+
+static void write_all(int fd, const void *buf, size_t len) {
+	const char *p = (const char *) buf;
+	ssize_t n = 0;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		} else if (n == -1) {
+			fprintf(stderr, "playback: write failed: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+/* sleep until the samples written are no more than PLAYBACK_LEAD ahead of the clock */
+static void pace(struct player *player, double sample_rate) {
+	struct timespec deadline;
+	double ahead = 0;
+
+	if (player->written <= PLAYBACK_LEAD) {
+		return;
+	}
+
+	ahead = (player->written - PLAYBACK_LEAD) / sample_rate;
+	deadline.tv_sec = player->start.tv_sec + (time_t) ahead;
+	deadline.tv_nsec = player->start.tv_nsec + (long) ((ahead - (time_t) ahead) * 1e9);
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+		/* keep sleeping */
+	}
+}
+
+static void play_output(struct output *out) {
+	struct player *player = (struct player *) out->data;
+	size_t len = 0;
+
+	if (player->written == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &player->start);
+	}
+
+	len = pack_samples(player->samples, out->pcm, out->ring_len, out->synth->bps, 0);
+	write_all(player->fd, player->samples, len);
+	player->written += out->ring_len;
+
+	pace(player, out->synth->sample_rate);
+}
+
+static void init_player(struct output *out, struct synth *synth, struct player *player, int fd) {
+	memset(player, '\0', sizeof(struct player));
+	player->fd = fd;
+
+	init_output(out, synth, play_output, player);
+	out->period = PLAYBACK_PERIOD;
+}
+
+void play_text(struct synth *synth, int fd, const unsigned char *text, size_t len) {
+
+	struct player player;
+	struct output *out = NULL;
+
+	out = (struct output *) malloc(sizeof(struct output));
+	if (out == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+
+	init_player(out, synth, &player, fd);
+	write_text(out, text, len);
+	flush_output(out);
+
+	free(out);
+}
+
+/* the terminal's settings, put back on the way out however that happens */
+static struct termios saved_termios;
+static int saved_fd = -1;
+
+static void restore_terminal(void) {
+	if (saved_fd != -1) {
+		tcsetattr(saved_fd, TCSANOW, &saved_termios);
+		saved_fd = -1;
+	}
+}
+
+static void restore_terminal_and_die(int sig) {
+	restore_terminal();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/* deliver keystrokes as they're typed instead of a line at a time */
+static void raw_terminal(int in) {
+	struct termios t;
+
+	if (!isatty(in) || tcgetattr(in, &saved_termios) == -1) {
+		return;
+	}
+
+	t = saved_termios;
+	t.c_lflag &= ~ICANON;
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+
+	if (tcsetattr(in, TCSANOW, &t) == 0) {
+		saved_fd = in;
+		atexit(restore_terminal);
+		signal(SIGINT, restore_terminal_and_die);
+		signal(SIGTERM, restore_terminal_and_die);
+	}
+}
+
+void play_keys(struct synth *synth, int fd, int in) {
+
+	struct player player;
+	struct output *out = NULL;
+	struct pollfd pfd;
+	unsigned char keys[KEYS_READSIZE];
+	size_t idle = 0;
+	size_t space = 0;
+	ssize_t n = 0;
+	ssize_t i;
+	int typed = 0;
+	int done = 0;
+
+	out = (struct output *) malloc(sizeof(struct output));
+	if (out == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+
+	raw_terminal(in);
+	init_player(out, synth, &player, fd);
+
+	space = measure_inter_character_space(synth);
+
+	while (!done) {
+		pfd.fd = in;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		/* nothing typed: keep the stream fed with a period of silence, which paces us */
+		if (poll(&pfd, 1, 0) <= 0) {
+			write_silence(out, PLAYBACK_PERIOD);
+			idle += PLAYBACK_PERIOD;
+			continue;
+		}
+
+		n = read(in, keys, sizeof(keys));
+		if (n == -1 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (keys[i] == END_OF_SESSION) {
+				done = 1;
+				break;
+			}
+
+			/* silence while waiting for the key counts towards the gap before it */
+			if (typed && idle < space) {
+				write_silence(out, space - idle);
+			}
+			write_character(out, keys[i]);
+
+			typed = 1;
+			idle = 0;
+		}
+
+		/* send the end of the last character now rather than a period from now */
+		flush_output(out);
+	}
+
+	flush_output(out);
+	restore_terminal();
+
+	free(out);
+}
@@ -0,0 +1,143 @@
+ /*
+    progress.c - progress reports on a file descriptor for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "progress.h"
+#include "synth.h"
+
+/* -1 without --progress, or once the reader has gone away */
+static int progress_fd = -1;
+static const struct synth *progress_synth;
+
+/* nanoseconds, of the start and of when the next report is due */
+static uint64_t started;
+static uint64_t due;
+
+/* the workers and the writer update these from several threads */
+static uint64_t synthesized;
+static uint64_t written;
+static uint64_t frames;
+static uint64_t bytes;
+static uint64_t total;
+
+static uint64_t now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t get(uint64_t *p) {
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void report(uint64_t t, int done) {
+	char line[512];
+	double elapsed = (t - started) / 1e9;
+	double pcm_bytes = (double) get(&written) * channels * (progress_synth->bps / 8);
+	double audio = get(&written) / progress_synth->sample_rate;
+	int fd = __atomic_load_n(&progress_fd, __ATOMIC_RELAXED);
+	int n = 0;
+
+	if (fd == -1) {
+		return;
+	}
+
+	n = snprintf(line, sizeof(line), "synthesized=%llu written=%llu total=%llu frames=%llu bytes=%llu ratio=%.4f speed=%.2f elapsed=%.3f done=%d\n",
+		(unsigned long long) get(&synthesized), (unsigned long long) get(&written), (unsigned long long) get(&total),
+		(unsigned long long) get(&frames), (unsigned long long) get(&bytes),
+		pcm_bytes > 0 ? get(&bytes) / pcm_bytes : 0, elapsed > 0 ? audio / elapsed : 0, elapsed, done);
+
+	/* a reader that stops reading isn't a reason to stop rendering */
+	if (write(fd, line, n) != n) {
+		__atomic_store_n(&progress_fd, -1, __ATOMIC_RELAXED);
+	}
+}
+
+/* whoever gets to move the deadline on reports, everyone else carries on */
+static void poll_progress(void) {
+	uint64_t t = now();
+	uint64_t next = __atomic_load_n(&due, __ATOMIC_RELAXED);
+
+	if (t < next || !__atomic_compare_exchange_n(&due, &next, t + PROGRESS_PERIOD_MS * 1000000ULL, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	report(t, 0);
+}
+
+static void exit_progress(void) {
+	report(now(), 1);
+}
+
+void start_progress(int fd, const struct synth *synth) {
+	progress_synth = synth;
+	started = now();
+	due = started + PROGRESS_PERIOD_MS * 1000000ULL;
+
+	/* writes to a closed pipe fail instead, and the reports just stop */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (progress_fd == -1) {
+		atexit(exit_progress);
+	}
+	progress_fd = fd;
+}
+
+void expect_progress(size_t n) {
+	__atomic_store_n(&total, n, __ATOMIC_RELAXED);
+}
+
+void progress_synthesized(uint64_t samples) {
+	if (__atomic_load_n(&progress_fd, __ATOMIC_RELAXED) == -1) {
+		return;
+	}
+
+	__atomic_fetch_add(&synthesized, samples, __ATOMIC_RELAXED);
+	poll_progress();
+}
+
+void progress_wrote(uint64_t samples, uint64_t n, uint64_t len) {
+	if (__atomic_load_n(&progress_fd, __ATOMIC_RELAXED) == -1) {
+		return;
+	}
+
+	__atomic_fetch_add(&written, samples, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&frames, n, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&bytes, len, __ATOMIC_RELAXED);
+	poll_progress();
+}
+
+void progress_encoded(uint64_t samples, uint64_t n, uint64_t len) {
+	if (__atomic_load_n(&progress_fd, __ATOMIC_RELAXED) == -1) {
+		return;
+	}
+
+	__atomic_store_n(&written, samples, __ATOMIC_RELAXED);
+	__atomic_store_n(&frames, n, __ATOMIC_RELAXED);
+	__atomic_store_n(&bytes, len, __ATOMIC_RELAXED);
+	poll_progress();
+}
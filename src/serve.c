@@ -0,0 +1,812 @@
+ /*
+    serve.c - text-to-morse as a long-running server
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "normalize.h"
+#include "serve.h"
+#include "sink.h"
+#include "stats.h"
+#include "synth.h"
+
+#define SERVE_BACKLOG (512)
+#define SERVE_EVENTS (256)
+#define SERVE_READSIZE (16384)
+
+/*
+ * the main thread owns a connection while it's reading a request or
+ * writing an answer; a worker owns it, and nothing else touches it,
+ * from being queued until it's handed back on the done list.
+ */
+enum {
+	CONN_READING,
+	CONN_RENDERING,
+	CONN_WRITING
+};
+
+struct conn {
+	int fd;
+	int state;
+
+	/* close once the answer is sent */
+	int closing;
+
+	/* bytes received and not yet answered, possibly several requests */
+	unsigned char *in;
+	size_t in_len;
+	size_t in_cap;
+
+	/* the request at the front of in, once its header is parsed */
+	struct synth params;
+	const struct sink_type *type;
+	size_t header_len;
+	size_t text_len;
+
+	/* what the request's audio is cached by, when there's a cache */
+	struct cache_key key;
+
+	/* the answer: a status line, then the audio the worker rendered or the cache had */
+	char status[64];
+	size_t status_len;
+	struct buffer body;
+	const struct cache_entry *entry;
+	const unsigned char *answer;
+	size_t answer_len;
+	size_t sent;
+	int failed;
+
+	/* on the work queue or the done list */
+	struct conn *next;
+};
+
+struct server {
+	const struct synth *defaults;
+	const struct sink_type *type;
+
+	int epfd;
+	int listen_fd;
+	int tcp;
+	int accepting;
+	size_t nconns;
+
+	/* workers post finished connections here and poke wake_fd */
+	int wake_fd;
+
+	/* rendered answers, NULL without --cache; SIGUSR1 on signal_fd reports on it and --stats */
+	struct cache *cache;
+	int signal_fd;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct conn *queue;
+	struct conn **queue_tail;
+	struct conn *done;
+};
+
+/* epoll tags for the fds that aren't connections */
+static char listen_tag;
+static char wake_tag;
+static char signal_tag;
+
+static void watch(struct server *server, int op, int fd, uint32_t events, void *ptr) {
+	struct epoll_event ev;
+
+	memset(&ev, '\0', sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
+
+	if (epoll_ctl(server->epfd, op, fd, &ev) == -1) {
+		fprintf(stderr, "serve: epoll_ctl: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static int same_params(const struct synth *a, const struct synth *b) {
+	return a->wpm == b->wpm && a->fwpm == b->fwpm && a->frequency == b->frequency &&
+		a->sample_rate == b->sample_rate && a->bps == b->bps && a->phase_continuous == b->phase_continuous &&
+		a->fist.weight == b->fist.weight && a->fist.jitter == b->fist.jitter &&
+		a->fist.drift == b->fist.drift && a->fist.seed == b->fist.seed;
+}
+
+static void set_params(struct synth *synth, const struct synth *params) {
+	synth->wpm = params->wpm;
+	synth->fwpm = params->fwpm;
+	synth->frequency = params->frequency;
+	synth->sample_rate = params->sample_rate;
+	synth->bps = params->bps;
+	synth->phase_continuous = params->phase_continuous;
+	synth->fist = params->fist;
+}
+
+/*
+ * each worker keeps its synth and sinks from one request to the next and
+ * only rebuilds them when a request asks for something different, so
+ * encoders are reused and the shared tones stay referenced.
+ */
+static void render(struct conn *conn, struct synth *synth, int *ready, struct sink *sink, struct output *out, struct buffer *normal) {
+	const unsigned char *text = conn->in + conn->header_len;
+	size_t len = conn->text_len;
+	struct normalizer n;
+
+	conn->body.len = 0;
+	conn->failed = 0;
+
+	if (*ready && !same_params(synth, &conn->params)) {
+		exit_glyphs(synth);
+		exit_tone(synth);
+		exit_space(synth);
+		*ready = 0;
+	}
+
+	if (!*ready) {
+		default_synth(synth);
+		set_params(synth, &conn->params);
+
+		init_space(synth);
+		if (init_tone(synth) == -1 || init_glyphs(synth, 0) == -1) {
+			exit_tone(synth);
+			conn->failed = 1;
+			return;
+		}
+		*ready = 1;
+	}
+
+	if (sink->type != conn->type) {
+		delete_sink(sink);
+		if (new_sink(sink, conn->type) == -1) {
+			conn->failed = 1;
+			return;
+		}
+	}
+
+	/* the cache is keyed on the text as it was sent */
+	if (!is_normal(text, len)) {
+		if (reserve_buffer(normal, NORMALIZE_ROOM(len)) == -1) {
+			conn->failed = 1;
+			return;
+		}
+		init_normalizer(&n);
+		len = normalize(&n, normal->data, text, len, 1);
+		text = normal->data;
+	}
+
+	if (open_sink_buffer(sink, out, synth, &conn->body, measure_text(synth, text, len)) == -1) {
+		conn->failed = 1;
+		return;
+	}
+	STATS_ADD(STATS_INPUT_BYTES, conn->text_len);
+	write_text(out, text, len);
+	conn->failed = close_sink(sink, out) == -1;
+}
+
+static void *work(void *arg) {
+	struct server *server = (struct server *) arg;
+	struct synth synth;
+	struct sink sink;
+	struct buffer normal;
+	struct output *out = NULL;
+	struct conn *conn = NULL;
+	uint64_t one = 1;
+	int ready = 0;
+
+	memset(&sink, '\0', sizeof(sink));
+	memset(&normal, '\0', sizeof(normal));
+
+	out = (struct output *) malloc(sizeof(struct output));
+	if (out == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&server->lock);
+		while (server->queue == NULL) {
+			pthread_cond_wait(&server->cond, &server->lock);
+		}
+		conn = server->queue;
+		server->queue = conn->next;
+		if (server->queue == NULL) {
+			server->queue_tail = &server->queue;
+		}
+		pthread_mutex_unlock(&server->lock);
+
+		render(conn, &synth, &ready, &sink, out, &normal);
+
+		/* the cache takes the audio and the answer is sent from there */
+		if (server->cache != NULL && !conn->failed) {
+			conn->entry = cache_put(server->cache, &conn->key, conn->body.data, conn->body.len);
+			if (conn->entry != NULL) {
+				memset(&conn->body, '\0', sizeof(conn->body));
+			}
+		}
+
+		pthread_mutex_lock(&server->lock);
+		conn->next = server->done;
+		server->done = conn;
+		pthread_mutex_unlock(&server->lock);
+
+		if (write(server->wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+			fprintf(stderr, "serve: waking the event loop: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return NULL;
+}
+
+static void close_conn(struct server *server, struct conn *conn) {
+	if (conn->state != CONN_RENDERING) {
+		watch(server, EPOLL_CTL_DEL, conn->fd, 0, NULL);
+	}
+	close(conn->fd);
+
+	if (conn->entry != NULL) {
+		cache_release(server->cache, conn->entry);
+	}
+	free(conn->in);
+	free(conn->body.data);
+	free(conn);
+
+	/* room for another */
+	server->nconns--;
+	if (!server->accepting) {
+		watch(server, EPOLL_CTL_MOD, server->listen_fd, EPOLLIN, &listen_tag);
+		server->accepting = 1;
+	}
+}
+
+/* answer without rendering anything and hang up, since the framing may be lost */
+static void refuse(struct conn *conn, const char *reason) {
+	conn->status_len = snprintf(conn->status, sizeof(conn->status), "ERR %s\n", reason);
+	conn->answer_len = 0;
+	conn->sent = 0;
+	conn->closing = 1;
+	conn->header_len = conn->in_len;
+	conn->text_len = 0;
+}
+
+/* one NAME=VALUE field of a request header; -1 if it's not one we know or it's out of range */
+static int parse_field(struct conn *conn, char *field, int *have_length) {
+	char *value = strchr(field, '=');
+	char *end = NULL;
+	long n = 0;
+
+	if (value == NULL) {
+		return -1;
+	}
+	*value++ = '\0';
+
+	if (strcmp(field, "format") == 0) {
+		conn->type = find_sink_type(value);
+		return conn->type == NULL ? -1 : 0;
+	}
+
+	n = strtol(value, &end, 10);
+	if (*value == '\0' || *end != '\0') {
+		return -1;
+	}
+
+	if (strcmp(field, "length") == 0 && n >= 0 && n <= SERVE_MAX_TEXT) {
+		conn->text_len = n;
+		*have_length = 1;
+	} else if (strcmp(field, "wpm") == 0 && n >= 1 && n <= 100) {
+		conn->params.wpm = n;
+	} else if (strcmp(field, "fwpm") == 0 && n >= 1 && n <= 100) {
+		conn->params.fwpm = n;
+	} else if (strcmp(field, "tone") == 0 && n >= 60 && n <= 3000) {
+		conn->params.frequency = n;
+	} else if (strcmp(field, "rate") == 0 && n >= MIN_SAMPLE_RATE && n <= MAX_SAMPLE_RATE) {
+		conn->params.sample_rate = n;
+	} else if (strcmp(field, "bits") == 0 && valid_bps(n)) {
+		conn->params.bps = n;
+	} else if (strcmp(field, "phase") == 0 && (n == 0 || n == 1)) {
+		conn->params.phase_continuous = n;
+	} else if (strcmp(field, "weight") == 0 && n >= MIN_WEIGHT && n <= MAX_WEIGHT) {
+		conn->params.fist.weight = n;
+	} else if (strcmp(field, "jitter") == 0 && n >= 0 && n <= MAX_JITTER) {
+		conn->params.fist.jitter = n;
+	} else if (strcmp(field, "drift") == 0 && n >= 0 && n <= MAX_DRIFT) {
+		conn->params.fist.drift = n;
+	} else if (strcmp(field, "seed") == 0 && n >= 0) {
+		conn->params.fist.seed = n;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * look for a whole request at the front of the input: 1 if there is one
+ * (or it was refused and the answer is ready), 0 if more is needed.
+ */
+static int parse_request(struct server *server, struct conn *conn) {
+	unsigned char *nl = NULL;
+	char *field = NULL;
+	char *save = NULL;
+	int have_length = 0;
+	int follow = 0;
+
+	if (conn->header_len == 0) {
+		nl = (unsigned char *) memchr(conn->in, '\n', conn->in_len < SERVE_MAX_HEADER ? conn->in_len : SERVE_MAX_HEADER);
+		if (nl == NULL && conn->in_len >= SERVE_MAX_HEADER) {
+			refuse(conn, "header too long");
+			return 1;
+		} else if (nl == NULL) {
+			return 0;
+		}
+
+		*nl = '\0';
+		if (nl > conn->in && nl[-1] == '\r') {
+			nl[-1] = '\0';
+		}
+
+		default_synth(&conn->params);
+		set_params(&conn->params, server->defaults);
+		conn->type = server->type;
+		conn->text_len = 0;
+
+		/* fwpm follows wpm, as on the command line, unless it's given or the server has its own */
+		follow = server->defaults->fwpm == server->defaults->wpm;
+
+		for (field = strtok_r((char *) conn->in, " \t", &save); field != NULL; field = strtok_r(NULL, " \t", &save)) {
+			if (strncmp(field, "fwpm=", 5) == 0) {
+				follow = 0;
+			}
+			if (parse_field(conn, field, &have_length) == -1) {
+				refuse(conn, "bad field");
+				return 1;
+			}
+		}
+		if (!have_length) {
+			refuse(conn, "no length");
+			return 1;
+		}
+		if (follow) {
+			conn->params.fwpm = conn->params.wpm;
+		}
+
+		conn->header_len = nl - conn->in + 1;
+	}
+
+	return conn->in_len >= conn->header_len + conn->text_len;
+}
+
+/* drop the answered request from the input and go back to reading */
+static void answered(struct server *server, struct conn *conn) {
+	size_t used = conn->header_len + conn->text_len;
+
+	if (conn->entry != NULL) {
+		cache_release(server->cache, conn->entry);
+		conn->entry = NULL;
+	}
+
+	memmove(conn->in, conn->in + used, conn->in_len - used);
+	conn->in_len -= used;
+	conn->header_len = 0;
+	conn->text_len = 0;
+	conn->state = CONN_READING;
+
+	watch(server, EPOLL_CTL_MOD, conn->fd, EPOLLIN, conn);
+}
+
+/* 1 once the whole answer has gone and conn is reading again, 0 if it's waiting to write or closed */
+static int send_answer(struct server *server, struct conn *conn) {
+	struct iovec iov[2];
+	size_t total = conn->status_len + conn->answer_len;
+	ssize_t n = 0;
+
+	while (conn->sent < total) {
+		if (conn->sent < conn->status_len) {
+			iov[0].iov_base = conn->status + conn->sent;
+			iov[0].iov_len = conn->status_len - conn->sent;
+			iov[1].iov_base = (void *) conn->answer;
+			iov[1].iov_len = conn->answer_len;
+			n = writev(conn->fd, iov, 2);
+		} else {
+			n = write(conn->fd, conn->answer + conn->sent - conn->status_len, total - conn->sent);
+		}
+
+		if (n == -1 && errno == EINTR) {
+			continue;
+		} else if (n == -1 && errno == EAGAIN) {
+			watch(server, EPOLL_CTL_MOD, conn->fd, EPOLLOUT, conn);
+			return 0;
+		} else if (n == -1) {
+			close_conn(server, conn);
+			return 0;
+		}
+		conn->sent += n;
+	}
+
+	if (conn->closing) {
+		close_conn(server, conn);
+		return 0;
+	}
+
+	answered(server, conn);
+	return 1;
+}
+
+/*
+ * hand the next whole request to the workers, or send its refusal. the
+ * cache answers as many as are already here, one after another, until
+ * one has to wait to be rendered, written or read.
+ */
+static void next_request(struct server *server, struct conn *conn) {
+	for (;;) {
+		if (!parse_request(server, conn)) {
+			return;
+		} else if (conn->closing) {
+			conn->state = CONN_WRITING;
+			send_answer(server, conn);
+			return;
+		}
+
+		/* seen before: answer straight from the cache without bothering a worker */
+		if (server->cache != NULL) {
+			make_cache_key(&conn->key, &conn->params, conn->type, conn->in + conn->header_len, conn->text_len);
+			conn->entry = cache_get(server->cache, &conn->key);
+		}
+		if (conn->entry == NULL) {
+			break;
+		}
+
+		conn->answer = conn->entry->data;
+		conn->answer_len = conn->entry->len;
+		conn->status_len = snprintf(conn->status, sizeof(conn->status), "OK %zu\n", conn->answer_len);
+		conn->sent = 0;
+		conn->state = CONN_WRITING;
+		if (!send_answer(server, conn)) {
+			return;
+		}
+	}
+
+	/* not watched while rendering: nothing is read, so clients are held back */
+	watch(server, EPOLL_CTL_DEL, conn->fd, 0, NULL);
+	conn->state = CONN_RENDERING;
+
+	pthread_mutex_lock(&server->lock);
+	conn->next = NULL;
+	*server->queue_tail = conn;
+	server->queue_tail = &conn->next;
+	pthread_cond_signal(&server->cond);
+	pthread_mutex_unlock(&server->lock);
+}
+
+/* the rest of an answer, then whatever was asked for behind it */
+static void write_conn(struct server *server, struct conn *conn) {
+	if (send_answer(server, conn)) {
+		next_request(server, conn);
+	}
+}
+
+static void read_conn(struct server *server, struct conn *conn) {
+	unsigned char *p = NULL;
+	ssize_t n = 0;
+
+	if (conn->in_cap - conn->in_len < SERVE_READSIZE) {
+		p = (unsigned char *) realloc(conn->in, conn->in_cap + SERVE_READSIZE);
+		if (p == NULL) {
+			close_conn(server, conn);
+			return;
+		}
+		conn->in = p;
+		conn->in_cap += SERVE_READSIZE;
+	}
+
+	n = read(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+	if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+		return;
+	} else if (n <= 0) {
+		close_conn(server, conn);
+		return;
+	}
+	conn->in_len += n;
+
+	next_request(server, conn);
+}
+
+/* workers are done with these; send their answers */
+static void collect(struct server *server) {
+	struct conn *conn = NULL;
+	struct conn *next = NULL;
+	uint64_t count = 0;
+
+	if (read(server->wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+		fprintf(stderr, "serve: reading the wakeup: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_mutex_lock(&server->lock);
+	conn = server->done;
+	server->done = NULL;
+	pthread_mutex_unlock(&server->lock);
+
+	for (; conn != NULL; conn = next) {
+		next = conn->next;
+
+		if (conn->failed) {
+			conn->status_len = snprintf(conn->status, sizeof(conn->status), "ERR rendering failed\n");
+			conn->answer_len = 0;
+		} else {
+			conn->answer = conn->entry != NULL ? conn->entry->data : conn->body.data;
+			conn->answer_len = conn->entry != NULL ? conn->entry->len : conn->body.len;
+			conn->status_len = snprintf(conn->status, sizeof(conn->status), "OK %zu\n", conn->answer_len);
+		}
+		conn->sent = 0;
+		conn->state = CONN_WRITING;
+
+		watch(server, EPOLL_CTL_ADD, conn->fd, EPOLLOUT, conn);
+		write_conn(server, conn);
+	}
+}
+
+static void accept_conns(struct server *server) {
+	struct conn *conn = NULL;
+	int fd = -1;
+	int on = 1;
+
+	while (server->nconns < SERVE_MAX_CONNECTIONS) {
+		fd = accept(server->listen_fd, NULL, NULL);
+		if (fd == -1 && errno == EINTR) {
+			continue;
+		} else if (fd == -1) {
+			/* EAGAIN, or the client gave up before we got to it */
+			return;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+		if (server->tcp) {
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		}
+
+		conn = (struct conn *) calloc(1, sizeof(struct conn));
+		if (conn == NULL) {
+			close(fd);
+			return;
+		}
+		conn->fd = fd;
+		conn->state = CONN_READING;
+
+		watch(server, EPOLL_CTL_ADD, fd, EPOLLIN, conn);
+		server->nconns++;
+	}
+
+	/* full: leave the rest in the backlog until someone hangs up */
+	watch(server, EPOLL_CTL_MOD, server->listen_fd, 0, &listen_tag);
+	server->accepting = 0;
+}
+
+static int listen_unix(struct server *server, const char *path) {
+	struct sockaddr_un sun;
+	struct stat st;
+	int fd = -1;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "serve: socket path '%s' is too long\n", path);
+		return -1;
+	}
+
+	memset(&sun, '\0', sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	/* a socket left behind by an earlier run, but nothing else, is replaced */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1 || bind(fd, (struct sockaddr *) &sun, sizeof(sun)) == -1 || listen(fd, SERVE_BACKLOG) == -1) {
+		fprintf(stderr, "serve: could not listen on '%s': %s\n", path, strerror(errno));
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+
+	server->tcp = 0;
+	return fd;
+}
+
+static int listen_tcp(struct server *server, const char *address) {
+	struct addrinfo hints;
+	struct addrinfo *ai = NULL;
+	struct addrinfo *p = NULL;
+	const char *colon = strrchr(address, ':');
+	const char *port = colon == NULL ? address : colon + 1;
+	char host[256];
+	int fd = -1;
+	int on = 1;
+	int rc = 0;
+
+	host[0] = '\0';
+	if (colon != NULL && (size_t) (colon - address) < sizeof(host)) {
+		memcpy(host, address, colon - address);
+		host[colon - address] = '\0';
+	}
+
+	memset(&hints, '\0', sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	rc = getaddrinfo(host[0] == '\0' ? NULL : host, port, &hints, &ai);
+	if (rc != 0) {
+		fprintf(stderr, "serve: '%s': %s\n", address, gai_strerror(rc));
+		return -1;
+	}
+
+	for (p = ai; p != NULL; p = p->ai_next) {
+		fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
+		if (fd == -1) {
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(fd, p->ai_addr, p->ai_addrlen) == 0 && listen(fd, SERVE_BACKLOG) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(ai);
+
+	if (fd == -1) {
+		fprintf(stderr, "serve: could not listen on '%s': %s\n", address, strerror(errno));
+		return -1;
+	}
+
+	server->tcp = 1;
+	return fd;
+}
+
+/* SIGUSR1: say how the cache is doing, and where the time went */
+static void report(struct server *server) {
+	struct signalfd_siginfo si;
+	struct cache_stats stats;
+
+	while (read(server->signal_fd, &si, sizeof(si)) == sizeof(si)) {
+		if (server->cache != NULL) {
+			cache_get_stats(server->cache, &stats);
+			fprintf(stderr, "serve: cache: %llu hits, %llu misses, %llu evictions, %zu entries in %zu bytes\n",
+				(unsigned long long) stats.hits, (unsigned long long) stats.misses,
+				(unsigned long long) stats.evictions, stats.entries, stats.bytes);
+		}
+		report_stats(stderr);
+	}
+}
+
+int serve(const struct synth *defaults, const struct sink_type *type, const char *address, int jobs, size_t cache_size) {
+
+	struct server server;
+	struct epoll_event events[SERVE_EVENTS];
+	pthread_t thread;
+	sigset_t mask;
+	int n = 0;
+	int i;
+
+	memset(&server, '\0', sizeof(server));
+	server.defaults = defaults;
+	server.type = type;
+	server.queue_tail = &server.queue;
+	pthread_mutex_init(&server.lock, NULL);
+	pthread_cond_init(&server.cond, NULL);
+
+	/* a client hanging up mid-answer is an error on that connection, not a reason to die */
+	signal(SIGPIPE, SIG_IGN);
+
+	server.listen_fd = strchr(address, '/') != NULL ? listen_unix(&server, address) : listen_tcp(&server, address);
+	if (server.listen_fd == -1) {
+		return -1;
+	}
+
+	server.epfd = epoll_create1(EPOLL_CLOEXEC);
+	server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (server.epfd == -1 || server.wake_fd == -1) {
+		fprintf(stderr, "serve: %s\n", strerror(errno));
+		return -1;
+	}
+
+	watch(&server, EPOLL_CTL_ADD, server.listen_fd, EPOLLIN, &listen_tag);
+	watch(&server, EPOLL_CTL_ADD, server.wake_fd, EPOLLIN, &wake_tag);
+	server.accepting = 1;
+
+	if (cache_size > 0) {
+		server.cache = new_cache(cache_size);
+		if (server.cache == NULL) {
+			fprintf(stderr, "serve: could not set up the cache\n");
+			return -1;
+		}
+	}
+
+	if (server.cache != NULL || stats_format != STATS_OFF) {
+		/* blocked before the workers start, so they inherit it and only signal_fd sees it */
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGUSR1);
+		pthread_sigmask(SIG_BLOCK, &mask, NULL);
+		server.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+		if (server.signal_fd == -1) {
+			fprintf(stderr, "serve: signalfd: %s\n", strerror(errno));
+			return -1;
+		}
+		watch(&server, EPOLL_CTL_ADD, server.signal_fd, EPOLLIN, &signal_tag);
+	}
+
+	/* the workers run for as long as the server does */
+	for (i = 0; i < jobs; i++) {
+		if (pthread_create(&thread, NULL, work, &server) != 0) {
+			fprintf(stderr, "serve: could not start worker thread\n");
+			return -1;
+		}
+		pthread_detach(thread);
+	}
+
+	fprintf(stderr, "serve: listening on %s with %d worker%s\n", address, jobs, jobs == 1 ? "" : "s");
+
+	for (;;) {
+		n = epoll_wait(server.epfd, events, SERVE_EVENTS, -1);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		} else if (n == -1) {
+			fprintf(stderr, "serve: epoll_wait: %s\n", strerror(errno));
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct conn *conn = (struct conn *) events[i].data.ptr;
+
+			if (events[i].data.ptr == &listen_tag) {
+				accept_conns(&server);
+			} else if (events[i].data.ptr == &wake_tag) {
+				collect(&server);
+			} else if (events[i].data.ptr == &signal_tag) {
+				report(&server);
+			} else if (conn->state == CONN_READING) {
+				read_conn(&server, conn);
+			} else if (conn->state == CONN_WRITING) {
+				write_conn(&server, conn);
+			}
+		}
+	}
+
+	return 0;
+}
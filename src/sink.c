@@ -0,0 +1,185 @@
+ /*
+    sink.c - output formats for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "sink.h"
+#include "stats.h"
+
+static const struct sink_type *sink_types[] = {
+	&flac_sink,
+	&wav_sink,
+	&raw_sink,
+};
+
+#define NSINK_TYPES (sizeof(sink_types) / sizeof(sink_types[0]))
+
+const struct sink_type *find_sink_type(const char *name) {
+	size_t i;
+
+	for (i = 0; i < NSINK_TYPES; i++) {
+		if (strcasecmp(sink_types[i]->name, name) == 0) {
+			return sink_types[i];
+		}
+	}
+
+	return NULL;
+}
+
+const struct sink_type *sink_type_for_path(const char *filepath, const struct sink_type *fallback) {
+	const char *dot = strrchr(filepath, '.');
+	size_t i;
+
+	if (dot == NULL || strchr(dot, '/') != NULL) {
+		return fallback;
+	}
+
+	for (i = 0; i < NSINK_TYPES; i++) {
+		if (strcasecmp(sink_types[i]->extension, dot) == 0) {
+			return sink_types[i];
+		}
+	}
+
+	return fallback;
+}
+
+int reserve_buffer(struct buffer *buffer, size_t len) {
+	unsigned char *p = NULL;
+
+	if (buffer->len + len > buffer->cap) {
+		p = (unsigned char *) realloc(buffer->data, buffer->len + len);
+		if (p == NULL) {
+			return -1;
+		}
+		buffer->data = p;
+		buffer->cap = buffer->len + len;
+		STATS_ADD(STATS_REALLOCS, 1);
+		STATS_PEAK(STATS_PEAK_BUFFER, buffer->cap);
+	}
+
+	return 0;
+}
+
+int append_buffer(struct buffer *buffer, const void *data, size_t len) {
+	size_t cap = 0;
+
+	if (buffer->len + len > buffer->cap) {
+		cap = buffer->cap == 0 ? 4096 : buffer->cap;
+		while (buffer->len + len > cap) {
+			cap *= 2;
+		}
+		if (reserve_buffer(buffer, cap - buffer->len) == -1) {
+			return -1;
+		}
+	}
+
+	memcpy(buffer->data + buffer->len, data, len);
+	buffer->len += len;
+
+	return 0;
+}
+
+int new_sink(struct sink *sink, const struct sink_type *type) {
+	sink->type = type;
+	sink->state = type->create();
+
+	return sink->state == NULL ? -1 : 0;
+}
+
+void delete_sink(struct sink *sink) {
+	if (sink->type != NULL && sink->state != NULL) {
+		sink->type->destroy(sink->state);
+	}
+	sink->type = NULL;
+	sink->state = NULL;
+}
+
+int open_sink(struct sink *sink, struct output *out, struct synth *synth, char *filepath, size_t expected_samples) {
+	sink->filepath = filepath;
+	sink->buffer = NULL;
+	return sink->type->open(out, synth, sink->state, filepath, expected_samples);
+}
+
+int open_sink_buffer(struct sink *sink, struct output *out, struct synth *synth, struct buffer *buffer, size_t expected_samples) {
+	sink->filepath = NULL;
+	sink->buffer = buffer;
+	sink->base = buffer->len;
+	return sink->type->open_buffer(out, synth, sink->state, buffer, expected_samples);
+}
+
+#ifdef TTM_STATS
+/* standard output's length is anyone's guess */
+static size_t written(const struct sink *sink) {
+	struct stat st;
+
+	if (sink->buffer != NULL) {
+		return sink->buffer->len - sink->base;
+	} else if (strcmp(sink->filepath, "-") != 0 && stat(sink->filepath, &st) == 0) {
+		return st.st_size;
+	}
+
+	return 0;
+}
+#endif
+
+int close_sink(struct sink *sink, struct output *out) {
+	int rc = 0;
+	STATS_CLOCK(start);
+
+	/* the last flush on its own, so it isn't counted as closing too */
+	flush_output(out);
+
+	STATS_RESTART(start);
+	rc = sink->type->close(out);
+	STATS_TIME(STATS_CLOSE, start);
+	STATS_ADD(STATS_OUTPUTS, 1);
+	STATS_ADD(STATS_SAMPLES, out->total_samples);
+	STATS_ADD(STATS_OUTPUT_BYTES, rc == 0 ? written(sink) : 0);
+
+	return rc;
+}
+
+void init_sink(struct sink *sink, const struct sink_type *type, struct output *out, struct synth *synth, char *filepath, size_t expected_samples) {
+	if (new_sink(sink, type) == -1) {
+		fprintf(stderr, "ERROR: allocating %s output\n", type->name);
+		exit(EXIT_FAILURE);
+	}
+
+	if (open_sink(sink, out, synth, filepath, expected_samples) == -1) {
+		delete_sink(sink);
+		exit(EXIT_FAILURE);
+	}
+}
+
+void finish_sink(struct sink *sink, struct output *out) {
+	int ok = close_sink(sink, out) == 0;
+
+	fprintf(stderr, "encoding: %s\n", ok ? "succeeded" : "FAILED");
+
+	delete_sink(sink);
+
+	if (!ok) {
+		exit(EXIT_FAILURE);
+	}
+}
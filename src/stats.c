@@ -0,0 +1,98 @@
+ /*
+    stats.c - where the time goes, for --stats
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stats.h"
+
+int stats_format = STATS_OFF;
+
+#ifdef TTM_STATS
+
+uint64_t stats_timers[STATS_TIMERS];
+uint64_t stats_counters[STATS_COUNTERS];
+
+static uint64_t started;
+
+static void exit_stats(void) {
+	report_stats(stderr);
+}
+
+void start_stats(int format) {
+	if (stats_format == STATS_OFF) {
+		started = stats_now();
+		atexit(exit_stats);
+	}
+	stats_format = format;
+}
+
+static double seconds(uint64_t ns) {
+	return ns / 1e9;
+}
+
+static unsigned long long get(enum stats_counter counter) {
+	return __atomic_load_n(&stats_counters[counter], __ATOMIC_RELAXED);
+}
+
+void report_stats(FILE *out) {
+	uint64_t t[STATS_TIMERS];
+	uint64_t synthesis = 0;
+	double wall = 0;
+	int i;
+
+	for (i = 0; i < STATS_TIMERS; i++) {
+		t[i] = __atomic_load_n(&stats_timers[i], __ATOMIC_RELAXED);
+	}
+
+	/* the flushes happen inside write_text(), only what's left of it is synthesis */
+	synthesis = t[STATS_RENDER] > t[STATS_FLUSH] ? t[STATS_RENDER] - t[STATS_FLUSH] : 0;
+	wall = seconds(stats_now() - started);
+
+	if (stats_format == STATS_JSON) {
+		fprintf(out, "{\"wall_seconds\":%.6f,\"read_seconds\":%.6f,\"synthesis_seconds\":%.6f,"
+			"\"encode_seconds\":%.6f,\"finish_seconds\":%.6f,\"input_bytes\":%llu,\"characters\":%llu,"
+			"\"samples\":%llu,\"outputs\":%llu,\"output_bytes\":%llu,\"flushes\":%llu,"
+			"\"reallocs\":%llu,\"peak_buffer_bytes\":%llu}\n",
+			wall, seconds(t[STATS_READ]), seconds(synthesis), seconds(t[STATS_FLUSH]), seconds(t[STATS_CLOSE]),
+			get(STATS_INPUT_BYTES), get(STATS_CHARACTERS), get(STATS_SAMPLES), get(STATS_OUTPUTS),
+			get(STATS_OUTPUT_BYTES), get(STATS_FLUSHES), get(STATS_REALLOCS), get(STATS_PEAK_BUFFER));
+	} else if (stats_format == STATS_TEXT) {
+		fprintf(out, "stats: %.3fs wall; read %.3fs, synthesis %.3fs, encode %.3fs, finish %.3fs (thread time)\n",
+			wall, seconds(t[STATS_READ]), seconds(synthesis), seconds(t[STATS_FLUSH]), seconds(t[STATS_CLOSE]));
+		fprintf(out, "stats: %llu bytes in, %llu characters, %llu samples, %llu outputs of %llu bytes\n",
+			get(STATS_INPUT_BYTES), get(STATS_CHARACTERS), get(STATS_SAMPLES), get(STATS_OUTPUTS), get(STATS_OUTPUT_BYTES));
+		fprintf(out, "stats: %llu flushes, %llu reallocs, %llu bytes largest buffer\n",
+			get(STATS_FLUSHES), get(STATS_REALLOCS), get(STATS_PEAK_BUFFER));
+	}
+}
+
+#else
+
+void start_stats(int format) {
+	(void) format;
+	fprintf(stderr, "stats: not built in, configure with -DTTM_STATS=ON\n");
+}
+
+void report_stats(FILE *out) {
+	(void) out;
+}
+
+#endif
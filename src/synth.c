@@ -0,0 +1,955 @@
+ /*
+    synth.c - morse code waveform synthesis for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "arena.h"
+#include "morse.h"
+#include "stats.h"
+#include "synth.h"
+
+const int volume = DEFAULT_VOLUME;
+const int channels = DEFAULT_CHANNELS;
+
+int valid_bps(int n) {
+	return n == 8 || n == 16 || n == 24;
+}
+
+void default_synth(struct synth *synth) {
+	memset(synth, '\0', sizeof(struct synth));
+
+	synth->wpm = DEFAULT_WPM;
+	synth->fwpm = DEFAULT_FWPM;
+	synth->frequency = DEFAULT_FREQUENCY;
+	synth->sample_rate = DEFAULT_SAMPLE_RATE;
+	synth->bps = DEFAULT_BPS;
+	synth->fist.weight = DEFAULT_WEIGHT;
+	synth->fist.seed = DEFAULT_SEED;
+}
+
+int is_humanized(const struct synth *synth) {
+	return synth->fist.weight != DEFAULT_WEIGHT || synth->fist.jitter != 0 || synth->fist.drift != 0;
+}
+
+/* the speed heads for a new random target once every this many elements */
+#define DRIFT_PERIOD (32)
+
+static void init_keyer(struct keyer *keyer, const struct synth *synth) {
+	keyer->state = synth->fist.seed;
+	keyer->elements = 0;
+	keyer->speed_from = 1;
+	keyer->speed_to = 1;
+	keyer->carry = 0;
+}
+
+void init_output(struct output *out, struct synth *synth, void (*flush)(struct output *out), void *data) {
+	out->ring_len = 0;
+	out->synth = synth;
+	out->total_samples = 0;
+	out->position = 0;
+	out->timeline.origin = 0;
+	out->timeline.ticks = 0;
+	init_keyer(&out->keyer, synth);
+	out->skip = 0;
+	out->limit = SIZE_MAX;
+	out->period = RINGSIZE;
+	out->flush = flush;
+	out->data = data;
+	out->segment = NULL;
+	out->can_fail = 0;
+	out->failed = 0;
+}
+
+/* hand whatever is staged in the ring to the consumer */
+void flush_output(struct output *out) {
+	STATS_CLOCK(start);
+
+	if (out->ring_len > 0) {
+		out->flush(out);
+		out->ring_len = 0;
+		STATS_TIME(STATS_FLUSH, start);
+		STATS_ADD(STATS_FLUSHES, 1);
+	}
+}
+
+/* sign extend native 16-bit samples to the 32-bit ints libFLAC consumes,
+   scaled to bps: (x << 16) >> (32 - bps) */
+void widen_samples(int32_t * restrict dst, const int16_t * restrict src, size_t n, int bps) {
+	size_t i = 0;
+
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	__m128i shift = _mm_cvtsi32_si128(32 - bps);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_sra_epi32(_mm_unpacklo_epi16(zero, x), shift));
+		_mm_storeu_si128((__m128i *) (dst + i + 4), _mm_sra_epi32(_mm_unpackhi_epi16(zero, x), shift));
+	}
+#endif
+
+	for (; i < n; i++) {
+		dst[i] = bps >= 16 ? src[i] * (1 << (bps - 16)) : src[i] >> (16 - bps);
+	}
+}
+
+/* append len samples to the ring, or len samples of silence when data is NULL */
+static void write_samples(struct output *out, const int16_t *data, size_t len) {
+
+	size_t n = 0;
+
+	out->position += len;
+
+	if (out->skip > 0) {
+		n = len < out->skip ? len : out->skip;
+		out->skip -= n;
+		len -= n;
+		data = data == NULL ? NULL : data + n;
+	}
+
+	n = out->limit - out->total_samples;
+	len = len < n ? len : n;
+
+	if (out->segment != NULL && len > 0) {
+		out->segment(out, data, len);
+		out->total_samples += len;
+		return;
+	}
+
+	while (len > 0) {
+		n = out->period - out->ring_len;
+		n = len < n ? len : n;
+
+		if (data == NULL) {
+			memset(out->pcm + out->ring_len, '\0', n * sizeof(int32_t));
+		} else {
+			widen_samples(out->pcm + out->ring_len, data, n, out->synth->bps);
+			data += n;
+		}
+
+		out->ring_len += n;
+		out->total_samples += n;
+		len -= n;
+
+		if (out->ring_len >= out->period) {
+			flush_output(out);
+		}
+	}
+}
+
+/* the timeline starts again from wherever these end */
+static void restart_timeline(struct output *out) {
+	out->timeline.origin = out->position;
+	out->timeline.ticks = 0;
+}
+
+void write_result(struct output *out, const int16_t *data, size_t len) {
+	write_samples(out, data, len);
+	restart_timeline(out);
+}
+
+void write_silence(struct output *out, size_t len) {
+	write_samples(out, NULL, len);
+	restart_timeline(out);
+}
+
+/* useful timing details: https://morsecode.world/international/timing.html */
+static uint64_t ticks_dit(const struct synth *synth) { return 1 * synth->unit_ticks; }
+static uint64_t ticks_dah(const struct synth *synth) { return 3 * synth->unit_ticks; }
+static uint64_t ticks_intra_character_space(const struct synth *synth) { return 1 * synth->unit_ticks; }
+static uint64_t ticks_inter_character_space(const struct synth *synth) { return 3 * synth->gap_ticks; }
+static uint64_t ticks_inter_word_space(const struct synth *synth)      { return 5 * synth->gap_ticks; }
+/* inter word space is 5 because there are ticks_intra_character_space
+   before and after the space to bring it up to 7 */
+
+/* ticks to the nearest whole sample */
+static size_t ticks_to_samples(const struct synth *synth, uint64_t ticks) {
+	return (2 * ticks + synth->sample_ticks) / (2 * synth->sample_ticks);
+}
+
+/* whether a unit is a whole number of samples, so every character comes out the same wherever it starts */
+static int whole_units(const struct synth *synth) {
+	return synth->unit_ticks % synth->sample_ticks == 0;
+}
+
+static int nsamples_dit(const struct synth *synth) { return ticks_to_samples(synth, ticks_dit(synth)); }
+
+/* rise and fall is 10% of dit */
+static int nsamples_rise_time(const struct synth *synth) { return nsamples_dit(synth) / 10; }
+static int nsamples_fall_time(const struct synth *synth) { return nsamples_dit(synth) / 10; }
+
+/* the oscillator is re-seeded from sin()/cos() this often so rounding
+   error can't build up over long tones */
+#define PHASOR_RESYNC (256)
+
+/* a sine wave starting at phase (radians), by rotating a phasor one step per sample */
+static void make_sine(const struct synth *synth, int16_t *samples, size_t nsamples, double phase) {
+	double step = synth->frequency * 2 * M_PI / synth->sample_rate;
+	double cos_step = cos(step);
+	double sin_step = sin(step);
+	double re = 1;
+	double im = 0;
+	double t = 0;
+	size_t i;
+
+	for (i = 0; i < nsamples; i++) {
+		if (i % PHASOR_RESYNC == 0) {
+			re = cos(phase + step * i);
+			im = sin(phase + step * i);
+		}
+
+		samples[i] = volume * im;
+
+		t = re * cos_step - im * sin_step;
+		im = re * sin_step + im * cos_step;
+		re = t;
+	}
+}
+
+/* samples[i] *= envelope[i], truncating like the scalar code does */
+static void scale_samples(int16_t * restrict samples, const double * restrict envelope, size_t n) {
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = _mm_loadl_epi64((const __m128i *) (samples + i));
+		__m128d lo, hi;
+
+		x = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		lo = _mm_mul_pd(_mm_cvtepi32_pd(x), _mm_loadu_pd(envelope + i));
+		hi = _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2))), _mm_loadu_pd(envelope + i + 2));
+		x = _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+		_mm_storel_epi64((__m128i *) (samples + i), _mm_packs_epi32(x, x));
+	}
+#endif
+
+	for (; i < n; i++) {
+		samples[i] = samples[i] * envelope[i];
+	}
+}
+
+/* a fist's pieces, in write_keyed_tone() */
+#define FALL_STEPS (256)
+#define CARRIER_UNITS (8)
+
+struct tones {
+	/* what they were rendered for */
+	int wpm;
+	double frequency;
+	double sample_rate;
+
+	/* guarded by tones_lock */
+	int refs;
+	struct tones *next;
+
+	/* every buffer below, all given back at once */
+	struct arena arena;
+
+	int16_t *dit_tone;
+	size_t dit_tone_len;
+	int16_t *dah_tone;
+	size_t dah_tone_len;
+
+	/* linear rise and fall, computed once and shared by every tone */
+	double *rise_envelope;
+	size_t rise_envelope_len;
+	double *fall_envelope;
+	size_t fall_envelope_len;
+
+	/*
+	 * filled on first use, by whichever thread gets there first, and
+	 * never changed after; read and written with atomics only. glyphs
+	 * are only used when a unit is a whole number of samples; otherwise
+	 * a tone is a sample longer wherever its edges round apart, which
+	 * is phase_tones[dah][1]. step zero of phase_tones[dah][0] is
+	 * dit_tone and dah_tone.
+	 */
+	int16_t *glyphs[256];
+	int16_t *phase_tones[2][2][PHASE_STEPS];
+
+	/* a fist's pieces */
+	int16_t *carrier;
+	int16_t *fall_tails[FALL_STEPS];
+};
+
+/* every set of tones in use; the lock covers the list and the counts, not the samples */
+static pthread_mutex_t tones_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tones *tones_list = NULL;
+
+static int16_t *cached(int16_t **slot) {
+	return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * make samples the cached copy unless another thread beat us to it;
+ * returns the one kept. the loser's copy stays in the arena, which only
+ * happens when threads race for the same character.
+ */
+static int16_t *publish(int16_t **slot, int16_t *samples) {
+	int16_t *kept = NULL;
+
+	if (!__atomic_compare_exchange_n(slot, &kept, samples, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+		return kept;
+	}
+
+	return samples;
+}
+
+static int16_t *alloc_samples(struct tones *tones, size_t len) {
+	return (int16_t *) arena_alloc(&tones->arena, len * sizeof(int16_t));
+}
+
+static int make_envelope(struct tones *tones, int rise_time, int fall_time) {
+	size_t i;
+
+	tones->rise_envelope_len = rise_time;
+	tones->rise_envelope = (double *) arena_alloc(&tones->arena, (tones->rise_envelope_len + 1) * sizeof(double));
+	if (tones->rise_envelope == NULL) {
+		return -1;
+	}
+	for (i = 0; i < tones->rise_envelope_len; i++) {
+		tones->rise_envelope[i] = i * 1.0 / rise_time;
+	}
+
+	/* the last fall_time - 1 samples, ending one step above zero */
+	tones->fall_envelope_len = fall_time > 0 ? fall_time - 1 : 0;
+	tones->fall_envelope = (double *) arena_alloc(&tones->arena, (tones->fall_envelope_len + 1) * sizeof(double));
+	if (tones->fall_envelope == NULL) {
+		return -1;
+	}
+	for (i = 0; i < tones->fall_envelope_len; i++) {
+		tones->fall_envelope[i] = (tones->fall_envelope_len - i) * 1.0 / fall_time;
+	}
+
+	return 0;
+}
+
+/* shape output waveform so sound isn't as harsh */
+static void shape_tone(const struct tones *tones, int16_t *samples, size_t nsamples) {
+	size_t rise = tones->rise_envelope_len < nsamples ? tones->rise_envelope_len : nsamples;
+	size_t fall = tones->fall_envelope_len < nsamples - rise ? tones->fall_envelope_len : nsamples - rise;
+
+	scale_samples(samples, tones->rise_envelope, rise);
+	scale_samples(samples + nsamples - fall, tones->fall_envelope + tones->fall_envelope_len - fall, fall);
+}
+
+static void free_tones(struct tones *tones) {
+	free_arena(&tones->arena);
+	free(tones);
+}
+
+static struct tones *make_tones(const struct synth *synth) {
+	struct tones *tones = NULL;
+
+	tones = (struct tones *) calloc(1, sizeof(struct tones));
+	if (tones == NULL) {
+		return NULL;
+	}
+	tones->wpm = synth->wpm;
+	tones->frequency = synth->frequency;
+	tones->sample_rate = synth->sample_rate;
+	init_arena(&tones->arena);
+
+	if (make_envelope(tones, nsamples_rise_time(synth), nsamples_fall_time(synth)) == -1) {
+		free_tones(tones);
+		return NULL;
+	}
+
+	/* both tones start at phase zero, so the dit is the start of the dah's sine; a sample longer is left for later */
+	tones->dah_tone_len = ticks_dah(synth) / synth->sample_ticks;
+	tones->dah_tone = alloc_samples(tones, tones->dah_tone_len);
+	if (tones->dah_tone == NULL) {
+		free_tones(tones);
+		return NULL;
+	}
+	make_sine(synth, tones->dah_tone, tones->dah_tone_len, 0);
+
+	tones->dit_tone_len = ticks_dit(synth) / synth->sample_ticks;
+	tones->dit_tone = alloc_samples(tones, tones->dit_tone_len);
+	if (tones->dit_tone == NULL) {
+		free_tones(tones);
+		return NULL;
+	}
+	memcpy(tones->dit_tone, tones->dah_tone, tones->dit_tone_len * sizeof(int16_t));
+
+	shape_tone(tones, tones->dit_tone, tones->dit_tone_len);
+	shape_tone(tones, tones->dah_tone, tones->dah_tone_len);
+
+	tones->phase_tones[0][0][0] = tones->dit_tone;
+	tones->phase_tones[1][0][0] = tones->dah_tone;
+
+	return tones;
+}
+
+int init_tone(struct synth *synth) {
+	struct tones *tones = NULL;
+
+	pthread_mutex_lock(&tones_lock);
+
+	for (tones = tones_list; tones != NULL; tones = tones->next) {
+		if (tones->wpm == synth->wpm && tones->frequency == synth->frequency && tones->sample_rate == synth->sample_rate) {
+			break;
+		}
+	}
+
+	if (tones == NULL) {
+		tones = make_tones(synth);
+		if (tones != NULL) {
+			tones->next = tones_list;
+			tones_list = tones;
+		}
+	}
+
+	if (tones != NULL) {
+		tones->refs++;
+	}
+
+	pthread_mutex_unlock(&tones_lock);
+
+	synth->tones = tones;
+	return tones == NULL ? -1 : 0;
+}
+
+void exit_tone(struct synth *synth) {
+	struct tones *tones = synth->tones;
+	struct tones **p = NULL;
+
+	if (tones == NULL) {
+		return;
+	}
+	synth->tones = NULL;
+
+	pthread_mutex_lock(&tones_lock);
+
+	tones->refs--;
+	if (tones->refs == 0) {
+		for (p = &tones_list; *p != tones; p = &(*p)->next) {
+			/* find it */
+		}
+		*p = tones->next;
+		free_tones(tones);
+	}
+
+	pthread_mutex_unlock(&tones_lock);
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+	uint64_t t = 0;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/*
+ * a unit is sample_rate * 60 / (50 * wpm) samples, so with a sample
+ * 5 * wpm * fwpm ticks long a unit at either speed is a whole number of
+ * ticks. silence is never stored, only its length; write_silence()
+ * zeroes the encoder's pcm[] block directly when the samples are needed.
+ */
+void init_space(struct synth *synth) {
+	uint64_t rate = (uint64_t) synth->sample_rate;
+	uint64_t sample = 5 * (uint64_t) synth->wpm * synth->fwpm;
+	uint64_t unit = 6 * rate * synth->fwpm;
+	uint64_t gap = 6 * rate * synth->wpm;
+	uint64_t g = gcd(gcd(sample, unit), gap);
+
+	synth->sample_ticks = sample / g;
+	synth->unit_ticks = unit / g;
+	synth->gap_ticks = gap / g;
+}
+
+void exit_space(struct synth *synth) {
+	synth->sample_ticks = 0;
+	synth->unit_ticks = 0;
+	synth->gap_ticks = 0;
+}
+
+/* the usual length, give or take a sample */
+size_t measure_inter_character_space(const struct synth *synth) {
+	return ticks_to_samples(synth, ticks_inter_character_space(synth));
+}
+
+/* how far write_character() moves the timeline for m, from the packed table */
+static uint64_t code_ticks(const struct synth *synth, const struct morse *m) {
+	if (m->space) {
+		return ticks_inter_word_space(synth);
+	} else if (m->len == 0) {
+		return 0;
+	}
+
+	return (m->len - m->dahs) * ticks_dit(synth) + m->dahs * ticks_dah(synth) +
+		(m->len - 1) * ticks_intra_character_space(synth);
+}
+
+size_t timeline_position(const struct synth *synth, const struct timeline *timeline) {
+	return timeline->origin + ticks_to_samples(synth, timeline->ticks);
+}
+
+void advance_character(const struct synth *synth, struct timeline *timeline, unsigned char c) {
+	timeline->ticks += synth->ticks[c];
+}
+
+void advance_inter_character_space(const struct synth *synth, struct timeline *timeline) {
+	timeline->ticks += ticks_inter_character_space(synth);
+}
+
+/* move out's timeline on by ticks, and return the samples it takes to catch up */
+static size_t advance_output(struct output *out, uint64_t ticks) {
+	out->timeline.ticks += ticks;
+	return timeline_position(out->synth, &out->timeline) - out->position;
+}
+
+/* whether c renders as nothing but silence, i.e. a word space */
+int is_word_space(unsigned char c) {
+	return morse_table[c].space;
+}
+
+static int16_t *append_samples(int16_t *dst, const int16_t *src, size_t len) {
+	memcpy(dst, src, len * sizeof(int16_t));
+	return dst + len;
+}
+
+static int16_t *append_silence(int16_t *dst, size_t len) {
+	memset(dst, '\0', len * sizeof(int16_t));
+	return dst + len;
+}
+
+/* c's complete waveform; only for characters with tones in them, when units are whole samples */
+static const int16_t *find_glyph(const struct synth *synth, unsigned char c) {
+	int i;
+	int16_t *p = NULL;
+	int16_t *samples = NULL;
+	const struct morse *m = &morse_table[c];
+	struct tones *tones = synth->tones;
+
+	samples = cached(&tones->glyphs[c]);
+	if (samples != NULL) {
+		return samples;
+	}
+
+	samples = alloc_samples(tones, synth->ticks[c] / synth->sample_ticks);
+	if (samples == NULL) {
+		return NULL;
+	}
+
+	p = samples;
+	for (i = 0; i < m->len; i++) {
+		if (i != 0) {
+			p = append_silence(p, ticks_intra_character_space(synth) / synth->sample_ticks);
+		}
+		if (m->code & (1 << i)) {
+			p = append_samples(p, tones->dah_tone, tones->dah_tone_len);
+		} else {
+			p = append_samples(p, tones->dit_tone, tones->dit_tone_len);
+		}
+	}
+
+	return publish(&tones->glyphs[c], samples);
+}
+
+/* with phase_continuous the carrier runs freely and elements only key it on
+   and off, so a tone's samples depend on where it starts in the output.
+   tones are cached per start phase, quantized to PHASE_STEPS of a cycle */
+static int phase_step(const struct synth *synth, size_t position) {
+	double cycles = synth->frequency * position / synth->sample_rate;
+
+	return (int) ((cycles - floor(cycles)) * PHASE_STEPS + 0.5) % PHASE_STEPS;
+}
+
+static const int16_t *find_phase_tone(const struct synth *synth, int dah, int longer, int step) {
+	struct tones *tones = synth->tones;
+	size_t len = (dah ? tones->dah_tone_len : tones->dit_tone_len) + longer;
+	int16_t *samples = NULL;
+
+	samples = cached(&tones->phase_tones[dah][longer][step]);
+	if (samples != NULL) {
+		return samples;
+	}
+
+	samples = alloc_samples(tones, len);
+	if (samples == NULL) {
+		return NULL;
+	}
+	make_sine(synth, samples, len, 2 * M_PI * step / PHASE_STEPS);
+	shape_tone(tones, samples, len);
+
+	return publish(&tones->phase_tones[dah][longer][step], samples);
+}
+
+/* a tone that couldn't be made */
+static void tone_failed(struct output *out) {
+	if (!out->can_fail) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+	out->failed = 1;
+}
+
+/* the edges are rounded apart, so the tone is the shorter one or a sample longer */
+static void write_tone(struct output *out, int dah) {
+	const struct synth *synth = out->synth;
+	size_t shortest = dah ? synth->tones->dah_tone_len : synth->tones->dit_tone_len;
+	int step = synth->phase_continuous ? phase_step(synth, out->position) : 0;
+	size_t len = advance_output(out, dah ? ticks_dah(synth) : ticks_dit(synth));
+	const int16_t *samples = find_phase_tone(synth, dah, len > shortest, step);
+
+	if (samples == NULL) {
+		tone_failed(out);
+	}
+
+	write_samples(out, samples, len);
+}
+
+/* element by element, since a glyph would only be right at one phase or one sample offset */
+static void write_elements(struct output *out, unsigned char c) {
+	const struct morse *m = &morse_table[c];
+	int i;
+
+	for (i = 0; i < m->len; i++) {
+		if (i != 0) {
+			write_samples(out, NULL, advance_output(out, ticks_intra_character_space(out->synth)));
+		}
+		write_tone(out, (m->code >> i) & 1);
+	}
+}
+
+/*
+ * a fist's tones can be any length, so rather than one cached waveform
+ * per element each is stitched from three cached pieces: the shaped
+ * dah's rise, a run of unshaped carrier and a fall tail. the tail
+ * depends on the phase the fall starts at, which is cached in
+ * FALL_STEPS of a cycle; the carrier holds CARRIER_UNITS, which is
+ * as long as a tone can get.
+ */
+
+/* splitmix64, to [-1, 1) */
+static double next_random(struct keyer *keyer) {
+	uint64_t z = (keyer->state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z = z ^ (z >> 31);
+
+	return (z >> 11) * (2.0 / 9007199254740992.0) - 1;
+}
+
+/* one unit at wpm, unrounded */
+static double unit_length(const struct synth *synth, int wpm) {
+	return synth->sample_rate * 60.0 / (50.0 * wpm);
+}
+
+/* the next element or space's length, nominally nominal samples */
+static size_t plan_length(struct keyer *keyer, const struct synth *synth, double nominal) {
+	double speed = 0;
+	double jitter = 0;
+	size_t len = 0;
+
+	if (keyer->elements % DRIFT_PERIOD == 0) {
+		keyer->speed_from = keyer->speed_to;
+		keyer->speed_to = 1 + synth->fist.drift / 100.0 * next_random(keyer);
+	}
+	speed = keyer->speed_from + (keyer->speed_to - keyer->speed_from) * (keyer->elements % DRIFT_PERIOD) / DRIFT_PERIOD;
+
+	/* triangular, so most elements stay near their length */
+	jitter = 1 + synth->fist.jitter / 100.0 * (next_random(keyer) + next_random(keyer)) / 2;
+
+	keyer->elements++;
+
+	/* what earlier lengths lost or gained to rounding is made up here, so it never adds up */
+	nominal = nominal * speed * jitter + keyer->carry;
+	len = nominal > 0 ? floor(nominal + 0.5) : 0;
+	keyer->carry = nominal - len;
+
+	return len;
+}
+
+static size_t carrier_length(const struct synth *synth) {
+	return ceil(CARRIER_UNITS * unit_length(synth, synth->wpm));
+}
+
+/* a tone needs room for its rise and fall, and can't outrun the carrier */
+static size_t plan_tone(struct keyer *keyer, const struct synth *synth, double nominal) {
+	size_t len = plan_length(keyer, synth, nominal);
+	size_t shortest = synth->tones->rise_envelope_len + synth->tones->fall_envelope_len;
+	size_t longest = carrier_length(synth);
+	size_t kept = len < shortest ? shortest : len > longest ? longest : len;
+
+	/* the space after makes up for it */
+	keyer->carry += (double) len - (double) kept;
+
+	return kept;
+}
+
+static const int16_t *find_carrier(const struct synth *synth) {
+	struct tones *tones = synth->tones;
+	size_t len = carrier_length(synth);
+	int16_t *samples = NULL;
+
+	samples = cached(&tones->carrier);
+	if (samples != NULL) {
+		return samples;
+	}
+
+	samples = alloc_samples(tones, len);
+	if (samples == NULL) {
+		return NULL;
+	}
+	make_sine(synth, samples, len, 0);
+
+	return publish(&tones->carrier, samples);
+}
+
+/* the phase a fall starting at offset in a tone starts at */
+static int fall_step(const struct synth *synth, size_t offset) {
+	double cycles = synth->frequency * offset / synth->sample_rate;
+
+	return (int) ((cycles - floor(cycles)) * FALL_STEPS + 0.5) % FALL_STEPS;
+}
+
+static const int16_t *find_fall_tail(const struct synth *synth, int step) {
+	struct tones *tones = synth->tones;
+	int16_t *samples = NULL;
+
+	samples = cached(&tones->fall_tails[step]);
+	if (samples != NULL) {
+		return samples;
+	}
+
+	samples = alloc_samples(tones, tones->fall_envelope_len + 1);
+	if (samples == NULL) {
+		return NULL;
+	}
+	make_sine(synth, samples, tones->fall_envelope_len, 2 * M_PI * step / FALL_STEPS);
+	scale_samples(samples, tones->fall_envelope, tones->fall_envelope_len);
+
+	return publish(&tones->fall_tails[step], samples);
+}
+
+static void write_keyed_tone(struct output *out, size_t len) {
+	const struct synth *synth = out->synth;
+	size_t rise = synth->tones->rise_envelope_len;
+	size_t fall = synth->tones->fall_envelope_len;
+	const int16_t *carrier = find_carrier(synth);
+	const int16_t *tail = find_fall_tail(synth, fall_step(synth, len - fall));
+
+	if (carrier == NULL || tail == NULL) {
+		tone_failed(out);
+		write_samples(out, NULL, len);
+		return;
+	}
+
+	write_samples(out, synth->tones->dah_tone, rise);
+	write_samples(out, carrier + rise, len - rise - fall);
+	write_samples(out, tail, fall);
+}
+
+/*
+ * plan c's elements and spaces and, when out isn't NULL, write them;
+ * returns the number of samples. measuring and writing draw from the
+ * plan the same way, so they always agree.
+ */
+static size_t key_character(struct keyer *keyer, const struct synth *synth, struct output *out, unsigned char c) {
+	const struct morse *m = &morse_table[c];
+	double unit = unit_length(synth, synth->wpm);
+	double weight = (synth->fist.weight - DEFAULT_WEIGHT) / 50.0 * unit;
+	size_t len = 0;
+	size_t n = 0;
+	int i;
+
+	/* the inter character space after a word space doesn't follow a tone, so gets its weight back here */
+	if (m->space) {
+		len = plan_length(keyer, synth, 5 * unit_length(synth, synth->fwpm) + weight);
+		if (out != NULL) {
+			write_samples(out, NULL, len);
+		}
+		return len;
+	}
+
+	for (i = 0; i < m->len; i++) {
+		if (i != 0) {
+			len = plan_length(keyer, synth, unit - weight);
+			if (out != NULL) {
+				write_samples(out, NULL, len);
+			}
+			n += len;
+		}
+
+		len = plan_tone(keyer, synth, ((m->code >> i) & 1 ? 3 : 1) * unit + weight);
+		if (out != NULL) {
+			write_keyed_tone(out, len);
+		}
+		n += len;
+	}
+
+	return n;
+}
+
+static size_t key_inter_character_space(struct keyer *keyer, const struct synth *synth, struct output *out) {
+	double weight = (synth->fist.weight - DEFAULT_WEIGHT) / 50.0 * unit_length(synth, synth->wpm);
+	size_t len = plan_length(keyer, synth, 3 * unit_length(synth, synth->fwpm) - weight);
+
+	if (out != NULL) {
+		write_samples(out, NULL, len);
+	}
+	return len;
+}
+
+void write_inter_character_space(struct output *out) {
+	if (is_humanized(out->synth)) {
+		key_inter_character_space(&out->keyer, out->synth, out);
+		return;
+	}
+
+	write_samples(out, NULL, advance_output(out, ticks_inter_character_space(out->synth)));
+}
+
+/* whether c has a glyph to render, rather than being silence or nothing */
+static int has_glyph(unsigned char c) {
+	return !morse_table[c].space && morse_table[c].len > 0;
+}
+
+int init_glyphs(struct synth *synth, int prerender) {
+	int steps = synth->phase_continuous ? PHASE_STEPS : 1;
+	int longer = whole_units(synth) ? 1 : 2;
+	int c;
+	int i;
+
+	for (c = 0; c < 256; c++) {
+		synth->ticks[c] = code_ticks(synth, &morse_table[c]);
+	}
+
+	if (prerender && is_humanized(synth)) {
+		if (find_carrier(synth) == NULL) {
+			return -1;
+		}
+		for (c = 0; c < FALL_STEPS; c++) {
+			if (find_fall_tail(synth, c) == NULL) {
+				return -1;
+			}
+		}
+	} else if (prerender && (synth->phase_continuous || !whole_units(synth))) {
+		for (c = 0; c < steps; c++) {
+			for (i = 0; i < longer; i++) {
+				if (find_phase_tone(synth, 0, i, c) == NULL || find_phase_tone(synth, 1, i, c) == NULL) {
+					return -1;
+				}
+			}
+		}
+	} else if (prerender) {
+		for (c = 0; c < 256; c++) {
+			if (has_glyph(c) && find_glyph(synth, c) == NULL) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* the glyphs themselves belong to the shared tones, freed by the last exit_tone() */
+void exit_glyphs(struct synth *synth) {
+	memset(synth->ticks, '\0', sizeof(synth->ticks));
+}
+
+void write_character(struct output *out, unsigned char c) {
+	const int16_t *samples = NULL;
+
+	if (is_humanized(out->synth)) {
+		key_character(&out->keyer, out->synth, out, c);
+		return;
+	} else if (morse_table[c].space) {
+		write_samples(out, NULL, advance_output(out, out->synth->ticks[c]));
+		return;
+	} else if (!has_glyph(c)) {
+		return;
+	} else if (out->synth->phase_continuous || !whole_units(out->synth)) {
+		write_elements(out, c);
+		return;
+	}
+
+	samples = find_glyph(out->synth, c);
+	if (samples == NULL) {
+		tone_failed(out);
+	}
+
+	write_samples(out, samples, advance_output(out, out->synth->ticks[c]));
+}
+
+/* pre-pass over the input to find the exact length of the output */
+size_t measure_text(const struct synth *synth, const unsigned char *text, size_t len) {
+	struct timeline timeline;
+	struct keyer keyer;
+	size_t n = 0;
+	size_t i;
+
+	/* a fist's lengths only come from replaying its plan */
+	if (is_humanized(synth)) {
+		init_keyer(&keyer, synth);
+		for (i = 0; i < len; i++) {
+			if (i != 0) {
+				n += key_inter_character_space(&keyer, synth, NULL);
+			}
+			n += key_character(&keyer, synth, NULL, text[i]);
+		}
+		return n;
+	}
+
+	/* otherwise it's where the timeline ends up, and the characters' ticks just add up */
+	memset(&timeline, '\0', sizeof(timeline));
+	for (i = 0; i < len; i++) {
+		advance_character(synth, &timeline, text[i]);
+	}
+	if (len > 0) {
+		timeline.ticks += (len - 1) * ticks_inter_character_space(synth);
+	}
+
+	return timeline_position(synth, &timeline);
+}
+
+/* synthesize the whole input */
+void write_text(struct output *out, const unsigned char *text, size_t len) {
+	size_t i;
+	STATS_CLOCK(start);
+
+	for (i = 0; i < len; i++) {
+		if (i != 0) {
+			write_inter_character_space(out);
+		}
+		write_character(out, text[i]);
+	}
+
+	STATS_TIME(STATS_RENDER, start);
+	STATS_ADD(STATS_CHARACTERS, len);
+}
@@ -19,486 +19,72 @@
  */
 
 #include <fcntl.h>
-#include <math.h>
+#include <getopt.h>
 #include <stdio.h>
-#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "batch.h"
+#include "cache.h"
+#include "encode.h"
+#include "input.h"
+#include "mix.h"
+#include "parallel.h"
+#include "playback.h"
+#include "progress.h"
+#include "serve.h"
+#include "sink.h"
+#include "stats.h"
+#include "synth.h"
 #include "version.h"
 
 #define VERSION (TEXT_TO_CW_VERSION_STRING)
-#define DEFAULT_FREQUENCY (600)
-#define DEFAULT_WPM (18)
-#define DEFAULT_FWPM DEFAULT_WPM
-#define DEFAULT_SAMPLE_RATE (44100)
-#define DEFAULT_CHANNELS (1)
-#define DEFAULT_BPS (16)
-#define DEFAULT_VOLUME (16384 * (0.50))
-#define DEFAULT_COMPRESSION_LEVEL (8)
-#define DEFAULT_VERIFY (1)
-
-const int verify = DEFAULT_VERIFY;
-const int volume = DEFAULT_VOLUME;
-const int channels = DEFAULT_CHANNELS;
-const int bps = DEFAULT_BPS;
-const int compression_level = DEFAULT_COMPRESSION_LEVEL;
-const double sample_rate = DEFAULT_SAMPLE_RATE;
-double frequency = DEFAULT_FREQUENCY;
-
-int16_t *result = NULL;
-size_t result_len = 0;
-size_t total_samples = 0;
-
-static void write_result(int16_t *data, size_t len) {
-
-	int16_t *new_result = NULL;
-	size_t new_len = 0;
-
-	new_len = result_len + len;
-
-	new_result = (int16_t *) realloc(result, new_len * sizeof(int16_t));
-	if (new_result == NULL) {
-		fprintf(stderr, "malloc failed :(\n");
-		exit(EXIT_FAILURE);
-	}
-
-	memcpy(new_result + result_len, data, len * sizeof(int16_t));
-
-	result = new_result;
-	result_len += len;
-	total_samples = result_len;
-
-}
-
-
-/* useful timing details: https://morsecode.world/international/timing.html */
-static int nsamples_unit(int wpm) {
-	return sample_rate * (60.0 / (50.0 * wpm));
-}
-
-static int nsamples_dit(int wpm) { return 1 * nsamples_unit(wpm); }
-static int nsamples_dah(int wpm) { return 3 * nsamples_unit(wpm); }
-static int nsamples_intra_character_space(int wpm) { return 1 * nsamples_unit(wpm); }
-static int nsamples_inter_character_space(int wpm) { return 3 * nsamples_unit(wpm); }
-static int nsamples_inter_word_space(int wpm)      { return 5 * nsamples_unit(wpm); }
-/* inter word space is 5 because there are nsamples_intra_character_space
-   before and after the space to bring it up to 7 */
-
-/* shape output waveform so sound isn't as harsh, rise and fall is 10% of dit */
-static int nsamples_rise_time(int wpm) { return nsamples_dit(wpm) / 10; }
-static int nsamples_fall_time(int wpm) { return nsamples_dit(wpm) / 10; }
-
-static int16_t *dit_tone = NULL;
-static size_t dit_tone_len = 0;
-static int16_t *dah_tone = NULL;
-static size_t dah_tone_len = 0;
-
-static void make_tone(int16_t *samples, size_t nsamples, int rise_time, int fall_time) {
-	int i;
-	for (i = 0; i < nsamples; i++) {
-		double t = (double) i / sample_rate;
-		samples[i] = volume * sin(frequency*t*2*M_PI);
-
-		if (i < rise_time) {
-			samples[i] = samples[i] * (i*1.0/rise_time*1.0);
-		} else if (i > nsamples - fall_time) {
-			samples[i] = samples[i] * ((nsamples-i)*1.0/fall_time*1.0);
-		}
-	}
-}
-
-static int init_tone(int wpm) {
-
-	int rise_time;
-	int fall_time;
-
-	rise_time = nsamples_rise_time(wpm);
-	fall_time = nsamples_fall_time(wpm);
-
-	dit_tone_len = nsamples_dit(wpm);
-	dit_tone = (int16_t *) malloc(dit_tone_len * sizeof(int16_t));
-	if (dit_tone == NULL) {
-		return -1;
-	}
-	make_tone(dit_tone, dit_tone_len, rise_time, fall_time);
-
-	dah_tone_len = nsamples_dah(wpm);
-	dah_tone = (int16_t *) malloc(dah_tone_len * sizeof(int16_t));
-	if (dah_tone == NULL) {
-		return -1;
-	}
-	make_tone(dah_tone, dah_tone_len, rise_time, fall_time);
-
-	return 0;
-}
-
-static void exit_tone(void) {
-	free(dit_tone);
-	dit_tone = NULL;
-	dit_tone_len = 0;
-
-	free(dah_tone);
-	dah_tone = NULL;
-	dah_tone_len = 0;
-}
-
-
-static void write_dit(void) {
-	write_result(dit_tone, dit_tone_len);
-}
-
-static void write_dah(void) {
-	write_result(dah_tone, dah_tone_len);
-}
-
-static void make_space(int16_t *samples, size_t nsamples) {
-	int i;
-	for (i = 0; i < nsamples; i++) {
-		samples[i] = 0;
-	}
-}
-
-static int16_t *inter_character_space = NULL;
-static size_t inter_character_space_len = 0;
-static int16_t *intra_character_space = NULL;
-static size_t intra_character_space_len = 0;
-static int16_t *inter_word_space = NULL;
-static size_t inter_word_space_len = 0;
-
-static int init_space(int wpm, int fwpm) {
-	inter_character_space_len = nsamples_inter_character_space(fwpm);
-	inter_character_space = (int16_t *) malloc(inter_character_space_len * sizeof(int16_t));
-	if (inter_character_space == NULL) {
-		return -1;
-	}
-	make_space(inter_character_space, inter_character_space_len);
 
-	intra_character_space_len = nsamples_intra_character_space(wpm);
-	intra_character_space = (int16_t *) malloc(intra_character_space_len * sizeof(int16_t));
-	if (intra_character_space == NULL) {
-		return -1;
-	}
-	make_space(intra_character_space, intra_character_space_len);
-
-	inter_word_space_len = nsamples_inter_word_space(fwpm);
-	inter_word_space = (int16_t *) malloc(inter_word_space_len * sizeof(int16_t));
-	if (inter_word_space == NULL) {
-		return -1;
-	}
-	make_space(inter_word_space, inter_word_space_len);
-
-	return 0;
-}
-
-static void exit_space(void) {
-	free(inter_character_space);
-	inter_character_space = NULL;
-	inter_character_space_len = 0;
-
-	free(intra_character_space);
-	intra_character_space = NULL;
-	intra_character_space_len = 0;
-
-	free(inter_word_space);
-	inter_word_space = NULL;
-	inter_word_space_len = 0;
-}
-
-static void write_inter_character_space(void) {
-	write_result(inter_character_space, inter_character_space_len);
-}
-
-static void write_intra_character_space(void) {
-	write_result(intra_character_space, intra_character_space_len);
-}
-
-static void write_inter_word_space(void) {
-	write_result(inter_word_space, inter_word_space_len);
-}
-
-const char *alphabet[] = {
-	"", /* 0 => '' */
-	"", /* 1 => '' */
-	"", /* 2 => '' */
-	"", /* 3 => '' */
-	"", /* 4 => '' */
-	"", /* 5 => '' */
-	"", /* 6 => '' */
-	" ", /* 7 => '' */
-	"", /* 8 => '' */
-	"", /* 9 => '' */
-	" ", /* 10 => '' */
-	"", /* 11 => '' */
-	"", /* 12 => '' */
-	"", /* 13 => '' */
-	"", /* 14 => '' */
-	"", /* 15 => '' */
-	"", /* 16 => '' */
-	"", /* 17 => '' */
-	"", /* 18 => '' */
-	"", /* 19 => '' */
-	"", /* 20 => '' */
-	"", /* 21 => '' */
-	"", /* 22 => '' */
-	"", /* 23 => '' */
-	"", /* 24 => '' */
-	"", /* 25 => '' */
-	"", /* 26 => '' */
-	"", /* 27 => ' */
-	"", /* 28 => '' */
-	"", /* 29 => '' */
-	"", /* 30 => '' */
-	"", /* 31 => '' */
-	" ", /* 32 => ' ' */
-	"", /* 33 => '!' */
-	"", /* 34 => '"' */
-	"", /* 35 => '#' */
-	"", /* 36 => '$' */
-	"", /* 37 => '%' */
-	"", /* 38 => '&' */
-	"", /* 39 => ''' */
-	"", /* 40 => '(' */
-	"", /* 41 => ')' */
-	"", /* 42 => '*' */
-	"", /* 43 => '+' */
-	"--..--", /* 44 => ',' */
-	"", /* 45 => '-' */
-	".-.-.-", /* 46 => '.' */
-	"", /* 47 => '/' */
-	"-----", /* 48 => '0' */
-	".----", /* 49 => '1' */
-	"..---", /* 50 => '2' */
-	"...--", /* 51 => '3' */
-	"....-", /* 52 => '4' */
-	".....", /* 53 => '5' */
-	"-....", /* 54 => '6' */
-	"--...", /* 55 => '7' */
-	"---..", /* 56 => '8' */
-	"----.", /* 57 => '9' */
-	"", /* 58 => ':' */
-	"", /* 59 => ';' */
-	"", /* 60 => '<' */
-	"-...-", /* 61 => '=' */
-	"", /* 62 => '>' */
-	"..--..", /* 63 => '?' */
-	"", /* 64 => '@' */
-	".-", /* 65 => 'A' */
-	"-...", /* 66 => 'B' */
-	"-.-.", /* 67 => 'C' */
-	"-..", /* 68 => 'D' */
-	".", /* 69 => 'E' */
-	"..-.", /* 70 => 'F' */
-	"--.", /* 71 => 'G' */
-	"....", /* 72 => 'H' */
-	"..", /* 73 => 'I' */
-	".---", /* 74 => 'J' */
-	"-.-", /* 75 => 'K' */
-	".-..", /* 76 => 'L' */
-	"--", /* 77 => 'M' */
-	"-.", /* 78 => 'N' */
-	"---", /* 79 => 'O' */
-	".--.", /* 80 => 'P' */
-	"--.-", /* 81 => 'Q' */
-	".-.", /* 82 => 'R' */
-	"...", /* 83 => 'S' */
-	"-", /* 84 => 'T' */
-	"..-", /* 85 => 'U' */
-	"...-", /* 86 => 'V' */
-	".--", /* 87 => 'W' */
-	"-..-", /* 88 => 'X' */
-	"-.--", /* 89 => 'Y' */
-	"--..", /* 90 => 'Z' */
-	"", /* 91 => '[' */
-	"", /* 92 => '\' */
-	"", /* 93 => ']' */
-	"", /* 94 => '^' */
-	"", /* 95 => '_' */
-	"", /* 96 => '`' */
-	".-", /* 97 => 'a' */
-	"-...", /* 98 => 'b' */
-	"-.-.", /* 99 => 'c' */
-	"-..", /* 100 => 'd' */
-	".", /* 101 => 'e' */
-	"..-.", /* 102 => 'f' */
-	"--.", /* 103 => 'g' */
-	"....", /* 104 => 'h' */
-	"..", /* 105 => 'i' */
-	".---", /* 106 => 'j' */
-	"-.-", /* 107 => 'k' */
-	".-..", /* 108 => 'l' */
-	"--", /* 109 => 'm' */
-	"-.", /* 110 => 'n' */
-	"---", /* 111 => 'o' */
-	".--.", /* 112 => 'p' */
-	"--.-", /* 113 => 'q' */
-	".-.", /* 114 => 'r' */
-	"...", /* 115 => 's' */
-	"-", /* 116 => 't' */
-	"..-", /* 117 => 'u' */
-	"...-", /* 118 => 'v' */
-	".--", /* 119 => 'w' */
-	"-..-", /* 120 => 'x' */
-	"-.--", /* 121 => 'y' */
-	"--..", /* 122 => 'z' */
-	"", /* 123 => '{' */
-	"", /* 124 => '|' */
-	"", /* 125 => '}' */
-	"", /* 126 => '~' */
-	"", /* 127 => '' */
-	"", /* 128 => '' */
-	"", /* 129 => '' */
-	"", /* 130 => '' */
-	"", /* 131 => '' */
-	"", /* 132 => '' */
-	"", /* 133 => '' */
-	"", /* 134 => '' */
-	"", /* 135 => '' */
-	"", /* 136 => '' */
-	"", /* 137 => '' */
-	"", /* 138 => '' */
-	"", /* 139 => '' */
-	"", /* 140 => '' */
-	"", /* 141 => '' */
-	"", /* 142 => '' */
-	"", /* 143 => '' */
-	"", /* 144 => '' */
-	"", /* 145 => '' */
-	"", /* 146 => '' */
-	"", /* 147 => '' */
-	"", /* 148 => '' */
-	"", /* 149 => '' */
-	"", /* 150 => '' */
-	"", /* 151 => '' */
-	"", /* 152 => '' */
-	"", /* 153 => '' */
-	"", /* 154 => '' */
-	"", /* 155 => '' */
-	"", /* 156 => '' */
-	"", /* 157 => '' */
-	"", /* 158 => '' */
-	"", /* 159 => '' */
-	"", /* 160 => ' ' */
-	"", /* 161 => '¡' */
-	"", /* 162 => '¢' */
-	"", /* 163 => '£' */
-	"", /* 164 => '¤' */
-	"", /* 165 => '¥' */
-	"", /* 166 => '¦' */
-	"", /* 167 => '§' */
-	"", /* 168 => '¨' */
-	"", /* 169 => '©' */
-	"", /* 170 => 'ª' */
-	"", /* 171 => '«' */
-	"", /* 172 => '¬' */
-	"", /* 173 => '' */
-	"", /* 174 => '®' */
-	"", /* 175 => '¯' */
-	"", /* 176 => '°' */
-	"", /* 177 => '±' */
-	"", /* 178 => '²' */
-	"", /* 179 => '³' */
-	"", /* 180 => '´' */
-	"", /* 181 => 'µ' */
-	"", /* 182 => '¶' */
-	"", /* 183 => '·' */
-	"", /* 184 => '¸' */
-	"", /* 185 => '¹' */
-	"", /* 186 => 'º' */
-	"", /* 187 => '»' */
-	"", /* 188 => '¼' */
-	"", /* 189 => '½' */
-	"", /* 190 => '¾' */
-	"", /* 191 => '¿' */
-	"", /* 192 => 'À' */
-	"", /* 193 => 'Á' */
-	"", /* 194 => 'Â' */
-	"", /* 195 => 'Ã' */
-	"", /* 196 => 'Ä' */
-	"", /* 197 => 'Å' */
-	"", /* 198 => 'Æ' */
-	"", /* 199 => 'Ç' */
-	"", /* 200 => 'È' */
-	"", /* 201 => 'É' */
-	"", /* 202 => 'Ê' */
-	"", /* 203 => 'Ë' */
-	"", /* 204 => 'Ì' */
-	"", /* 205 => 'Í' */
-	"", /* 206 => 'Î' */
-	"", /* 207 => 'Ï' */
-	"", /* 208 => 'Ð' */
-	"", /* 209 => 'Ñ' */
-	"", /* 210 => 'Ò' */
-	"", /* 211 => 'Ó' */
-	"", /* 212 => 'Ô' */
-	"", /* 213 => 'Õ' */
-	"", /* 214 => 'Ö' */
-	"", /* 215 => '×' */
-	"", /* 216 => 'Ø' */
-	"", /* 217 => 'Ù' */
-	"", /* 218 => 'Ú' */
-	"", /* 219 => 'Û' */
-	"", /* 220 => 'Ü' */
-	"", /* 221 => 'Ý' */
-	"", /* 222 => 'Þ' */
-	"", /* 223 => 'ß' */
-	"", /* 224 => 'à' */
-	"", /* 225 => 'á' */
-	"", /* 226 => 'â' */
-	"", /* 227 => 'ã' */
-	"", /* 228 => 'ä' */
-	"", /* 229 => 'å' */
-	"", /* 230 => 'æ' */
-	"", /* 231 => 'ç' */
-	"", /* 232 => 'è' */
-	"", /* 233 => 'é' */
-	"", /* 234 => 'ê' */
-	"", /* 235 => 'ë' */
-	"", /* 236 => 'ì' */
-	"", /* 237 => 'í' */
-	"", /* 238 => 'î' */
-	"", /* 239 => 'ï' */
-	"", /* 240 => 'ð' */
-	"", /* 241 => 'ñ' */
-	"", /* 242 => 'ò' */
-	"", /* 243 => 'ó' */
-	"", /* 244 => 'ô' */
-	"", /* 245 => 'õ' */
-	"", /* 246 => 'ö' */
-	"", /* 247 => '÷' */
-	"", /* 248 => 'ø' */
-	"", /* 249 => 'ù' */
-	"", /* 250 => 'ú' */
-	"", /* 251 => 'û' */
-	"", /* 252 => 'ü' */
-	"", /* 253 => 'ý' */
-	"", /* 254 => 'þ' */
-	"", /* 255 => 'ÿ' */
+static struct synth synth;
+static struct output result;
+static struct sink sink;
+
+/* encoder tuning only has long names */
+enum {
+	OPT_FAST = 256,
+	OPT_VERIFY,
+	OPT_NO_VERIFY,
+	OPT_BLOCKSIZE,
+	OPT_APODIZATION,
+	OPT_SERVE,
+	OPT_WEIGHT,
+	OPT_JITTER,
+	OPT_DRIFT,
+	OPT_SEED,
+	OPT_NOISE,
+	OPT_CACHE,
+	OPT_INCREMENTAL,
+	OPT_STATS,
+	OPT_PROGRESS
 };
 
-static void write_character(unsigned char c) {
-	int i;
-	const char *s = alphabet[c];
-
-	if (s == NULL || s[0] == '\0') return;
-	for (i = 0; s[i] != '\0'; i++) {
-		if (i != 0) {
-			write_intra_character_space();
-		}
-		switch (s[i]) {
-			case ' ':
-				write_inter_word_space();
-				break;
-			case '.':
-				write_dit();
-				break;
-			case '-':
-				write_dah();
-				break;
-		}
-	}
-}
+static const struct option long_options[] = {
+	{ "fast", no_argument, NULL, OPT_FAST },
+	{ "verify", no_argument, NULL, OPT_VERIFY },
+	{ "no-verify", no_argument, NULL, OPT_NO_VERIFY },
+	{ "blocksize", required_argument, NULL, OPT_BLOCKSIZE },
+	{ "apodization", required_argument, NULL, OPT_APODIZATION },
+	{ "serve", required_argument, NULL, OPT_SERVE },
+	{ "weight", required_argument, NULL, OPT_WEIGHT },
+	{ "jitter", required_argument, NULL, OPT_JITTER },
+	{ "drift", required_argument, NULL, OPT_DRIFT },
+	{ "seed", required_argument, NULL, OPT_SEED },
+	{ "noise", required_argument, NULL, OPT_NOISE },
+	{ "cache", required_argument, NULL, OPT_CACHE },
+	{ "incremental", required_argument, NULL, OPT_INCREMENTAL },
+	{ "stats", optional_argument, NULL, OPT_STATS },
+	{ "progress", required_argument, NULL, OPT_PROGRESS },
+	{ "compression-level", required_argument, NULL, 'l' },
+	{ "help", no_argument, NULL, 'h' },
+	{ "version", no_argument, NULL, 'V' },
+	{ NULL, 0, NULL, 0 }
+};
 
 static void show_version(FILE *out, int exit_code) {
 	fprintf(out, "text-to-morse v%s\n", VERSION);
@@ -508,133 +94,96 @@ static void show_version(FILE *out, int exit_code) {
 static void show_usage(FILE *out, int exit_code) {
 
 	fprintf(out, "usage: text-to-morse INPUT.TXT OUTPUT.FLAC\n");
+	fprintf(out, "       text-to-morse -b MANIFEST\n");
+	fprintf(out, "       text-to-morse -b INPUT_DIR OUTPUT_DIR\n");
+	fprintf(out, "       text-to-morse -m MIX OUTPUT.FLAC\n");
+	fprintf(out, "       text-to-morse -r [INPUT.TXT]\n");
+	fprintf(out, "       text-to-morse --serve ADDRESS\n");
+	fprintf(out, "\n");
+	fprintf(out, "INPUT.TXT and OUTPUT.FLAC may be '-' for standard input and output\n");
 	fprintf(out, "\n");
+	fprintf(out, "-b                    Batch mode, convert each 'INPUT.TXT OUTPUT.FLAC' line of MANIFEST\n");
+	fprintf(out, "                      or every file in INPUT_DIR, using -j NUM threads\n");
+	fprintf(out, "-c                    Keep the tone's phase continuous from one element to the next\n");
+	fprintf(out, "-d NUM                Bits per sample: 8, 16 or 24. Default %d\n", DEFAULT_BPS);
 	fprintf(out, "-f NUM                Farnsworth spacing words per minute. Default %d\n", DEFAULT_FWPM);
 	fprintf(out, "-h                    Display this help information and exit\n");
+	fprintf(out, "-j NUM                Synthesize and encode on NUM threads. Default 1\n");
+	fprintf(out, "-l NUM                FLAC compression level, 0 (fastest) to 8. Default %d\n", DEFAULT_COMPRESSION_LEVEL);
+	fprintf(out, "-m                    Mix every 'INPUT.TXT [NAME=VALUE ...]' voice of MIX into one output\n");
+	fprintf(out, "-o FORMAT             Output format: flac, wav or raw. Default from OUTPUT's\n");
+	fprintf(out, "                      extension, otherwise flac. -j only speeds up flac\n");
+	fprintf(out, "-p                    Prerender every character at startup instead of on first use\n");
+	fprintf(out, "-r                    Play raw PCM to standard output in real time, keying\n");
+	fprintf(out, "                      INPUT.TXT or, without one, each character as it's typed\n");
+	fprintf(out, "-s NUM                Sample rate in Hertz, %d to %d. Default %d\n", MIN_SAMPLE_RATE, MAX_SAMPLE_RATE, DEFAULT_SAMPLE_RATE);
 	fprintf(out, "-t NUM                Frequency of the generated tone in Hertz. Default %d\n", DEFAULT_FREQUENCY);
 	fprintf(out, "-V                    Display version information and exit\n");
 	fprintf(out, "-w NUM                Words per minute. Default %d\n", DEFAULT_WPM);
 	fprintf(out, "\n");
+	fprintf(out, "--fast                FLAC compression level %d without the verify pass\n", FAST_COMPRESSION_LEVEL);
+	fprintf(out, "--verify              Decode every FLAC frame again to check it%s\n", DEFAULT_VERIFY ? " (default)" : "");
+	fprintf(out, "--no-verify           Skip the verify pass%s\n", DEFAULT_VERIFY ? "" : " (default)");
+	fprintf(out, "--blocksize=NUM       FLAC block size, %d to %d. Default from the compression level\n", MIN_BLOCKSIZE, MAX_BLOCKSIZE);
+	fprintf(out, "--apodization=SPEC    FLAC apodization functions, e.g. tukey(0.5);partial_tukey(2)\n");
+	fprintf(out, "--weight=PCT          Keyed percent of each dit and the space after it, %d to %d. Default %d\n", MIN_WEIGHT, MAX_WEIGHT, DEFAULT_WEIGHT);
+	fprintf(out, "--jitter=PCT          Vary each element and space by up to PCT percent, 0 to %d. Default 0\n", MAX_JITTER);
+	fprintf(out, "--drift=PCT           Let the speed wander by up to PCT percent, 0 to %d. Default 0\n", MAX_DRIFT);
+	fprintf(out, "--seed=NUM            Seed for --jitter and --drift, the same seed keys the same way. Default %d\n", DEFAULT_SEED);
+	fprintf(out, "--noise=PCT           Band limited noise for -m, as a percent of a voice, 0 to %d. Default 0\n", MAX_NOISE);
+	fprintf(out, "--incremental=STASH   Keep each word's FLAC frames in STASH and only encode the words\n");
+	fprintf(out, "                      that weren't there last time, for re-rendering edited texts\n");
+	fprintf(out, "--serve=ADDRESS       Answer requests on a Unix socket path or [HOST:]PORT with -j NUM\n");
+	fprintf(out, "                      threads; the other options set the defaults\n");
+	fprintf(out, "--cache=MB            Keep up to MB megabytes of --serve answers to send again when the\n");
+	fprintf(out, "                      same text is asked for with the same settings. Default 0, off\n");
+	fprintf(out, "--progress=FD         Write a line of NAME=VALUE progress fields to file descriptor FD\n");
+	fprintf(out, "                      every %d ms and at the end, for a single output\n", PROGRESS_PERIOD_MS);
+	fprintf(out, "--stats[=json]        Report where the time went on exit (and on SIGUSR1 with --serve),\n");
+	fprintf(out, "                      if built with -DTTM_STATS=ON\n");
+	fprintf(out, "\n");
 
 	show_version(out, exit_code);
 }
 
-/**** ****/
-
-/* example_c_encode_file - Simple FLAC file encoder using libFLAC
- * Copyright (C) 2007-2009  Josh Coalson
- * Copyright (C) 2011-2024  Xiph.Org Foundation
- *
- * This program is free software; you can redistribute it and/or
- * modify it under the terms of the GNU General Public License
- * as published by the Free Software Foundation; either version 2
- * of the License, or (at your option) any later version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License along
- * with this program; if not, write to the Free Software Foundation, Inc.,
- * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
- */
-
-#include <inttypes.h>
-#include <FLAC/metadata.h>
-#include <FLAC/stream_encoder.h>
-
-#define READSIZE (1024)
-
-static FLAC__byte buffer[READSIZE * (DEFAULT_BPS/8) * DEFAULT_CHANNELS];
-static FLAC__int32 pcm[READSIZE * DEFAULT_CHANNELS];
-
-static void encode_result(char *filepath) {
-
-	FILE *fin = NULL;
-	FLAC__bool ok = true;
-	FLAC__StreamEncoder *encoder = 0;
-	FLAC__StreamEncoderInitStatus init_status;
-
-	/* TC: sample_rate, channels, bps, total_samples are globals ready to go*/
-
-	fin = fmemopen(result, sizeof(int16_t) * result_len, "r");
-	if (fin == NULL) {
-		fprintf(stderr, "ERROR: could not read resulting audio\n");
-		exit(EXIT_FAILURE);
-	}
-
-	if ((encoder = FLAC__stream_encoder_new()) == NULL) {
-		fprintf(stderr, "ERROR: allocating encoder\n");
-		exit(EXIT_FAILURE);
-	}
-
-        ok &= FLAC__stream_encoder_set_verify(encoder, verify ? true : false);
-        ok &= FLAC__stream_encoder_set_compression_level(encoder, compression_level);
-        ok &= FLAC__stream_encoder_set_channels(encoder, channels);
-        ok &= FLAC__stream_encoder_set_bits_per_sample(encoder, bps);
-        ok &= FLAC__stream_encoder_set_sample_rate(encoder, sample_rate);
-        ok &= FLAC__stream_encoder_set_total_samples_estimate(encoder, total_samples);
-
-        /* initialize encoder */
-        if (ok) {
-                init_status = FLAC__stream_encoder_init_file(encoder, filepath, /*progress_callback*/NULL, /*client_data=*/NULL);
-                if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
-                        fprintf(stderr, "ERROR: initializing encoder: %s\n", FLAC__StreamEncoderInitStatusString[init_status]);
-                        ok = false;
-                }
-        }
-
-
-        /* read blocks of samples from WAVE file and feed to encoder */
-        if (ok) {
-                size_t left = (size_t)total_samples;
-                while(ok && left) {
-                        size_t need = (left>READSIZE? (size_t)READSIZE : (size_t)left);
-			size_t count;
-
-			count = fread(buffer, channels*(bps/8), need, fin);
-                        if(count != need) {
-                                fprintf(stderr, "ERROR: reading from buffer result_len=%lu read=%lu need=%lu left=%lu size_per_elem=%d\n", result_len, count, need, left, channels*(bps/8));
-                                ok = false;
-                        } else {
-                                /* convert the packed little-endian 16-bit PCM samples from WAVE into an interleaved FLAC__int32 buffer for libFLAC */
-                                size_t i;
-                                for (i = 0; i < need*channels; i++) {
-					pcm[i] = (FLAC__int32)(((FLAC__int16)(FLAC__int8)buffer[2*i+1] << 8) | (FLAC__int16)buffer[2*i]);
-                                }
-                                /* feed samples to encoder */
-                                ok = FLAC__stream_encoder_process_interleaved(encoder, pcm, need);
-                        }
-                        left -= need;
-                }
-        }
-
-        ok &= FLAC__stream_encoder_finish(encoder);
-
-
-        fprintf(stderr, "encoding: %s\n", ok? "succeeded" : "FAILED");
-
-        FLAC__stream_encoder_delete(encoder);
-        fclose(fin);
-}
-
-
-
-/***** *****/
-
 int main(int argc, char *argv[]) {
 
-	FILE *input = NULL;
-	char ch = '\0';
+	struct text input;
+	const char *address = NULL;
+	const char *stash = NULL;
+	const struct sink_type *format = NULL;
+	const struct sink_type *type = NULL;
+	int parallel = 0;
+	int incremental = 0;
+	int ch = 0;
 	int wpm = DEFAULT_WPM;
 	int fwpm = 0;
+	int prerender = 0;
+	int jobs = 1;
+	int batch = 0;
+	int realtime = 0;
+	int mix = 0;
+	int noise = 0;
+	int cache = 0;
+	int progress = -1;
+	size_t expected = 0;
 	int rc = 0;
-	int i = 0;
 
-	while ((ch = getopt(argc, argv, "f:ht:Vw:")) != -1) {
+	default_synth(&synth);
+
+	while ((ch = getopt_long(argc, argv, "bcd:f:hj:l:mo:prs:t:Vw:", long_options, NULL)) != -1) {
 
 		switch (ch) {
+			case 'b':
+				batch = 1;
+				break;
+			case 'c':
+				synth.phase_continuous = 1;
+				break;
+			case 'd':
+				synth.bps = atoi(optarg);
+				synth.bps = valid_bps(synth.bps) ? synth.bps : DEFAULT_BPS;
+				break;
 			case 'f':
 				fwpm = atoi(optarg);
 				fwpm = fwpm < 1 || fwpm > 100 ? 0 : fwpm;
@@ -642,9 +191,37 @@ int main(int argc, char *argv[]) {
 			case 'h':
 				show_usage(stdout, EXIT_SUCCESS);
 				break;
+			case 'j':
+				jobs = atoi(optarg);
+				jobs = jobs < 1 || jobs > MAX_JOBS ? 1 : jobs;
+				break;
+			case 'l':
+				compression_level = atoi(optarg);
+				compression_level = compression_level < 0 || compression_level > 8 ? DEFAULT_COMPRESSION_LEVEL : compression_level;
+				break;
+			case 'm':
+				mix = 1;
+				break;
+			case 'o':
+				format = find_sink_type(optarg);
+				if (format == NULL) {
+					fprintf(stderr, "Unknown output format '%s'\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'p':
+				prerender = 1;
+				break;
+			case 'r':
+				realtime = 1;
+				break;
+			case 's':
+				synth.sample_rate = atoi(optarg);
+				synth.sample_rate = synth.sample_rate < MIN_SAMPLE_RATE || synth.sample_rate > MAX_SAMPLE_RATE ? DEFAULT_SAMPLE_RATE : synth.sample_rate;
+				break;
 			case 't':
-				frequency = atoi(optarg);
-				frequency = frequency < 60 || frequency > 3000 ? DEFAULT_FREQUENCY : frequency;
+				synth.frequency = atoi(optarg);
+				synth.frequency = synth.frequency < 60 || synth.frequency > 3000 ? DEFAULT_FREQUENCY : synth.frequency;
 				break;
 			case 'V':
 				show_version(stdout, EXIT_SUCCESS);
@@ -653,6 +230,59 @@ int main(int argc, char *argv[]) {
 				wpm = atoi(optarg);
 				wpm = wpm < 1 || wpm > 100 ? DEFAULT_WPM : wpm;
 				break;
+			case OPT_FAST:
+				compression_level = FAST_COMPRESSION_LEVEL;
+				verify = FAST_VERIFY;
+				break;
+			case OPT_VERIFY:
+				verify = 1;
+				break;
+			case OPT_NO_VERIFY:
+				verify = 0;
+				break;
+			case OPT_BLOCKSIZE:
+				flac_blocksize = atoi(optarg);
+				flac_blocksize = flac_blocksize < MIN_BLOCKSIZE || flac_blocksize > MAX_BLOCKSIZE ? DEFAULT_BLOCKSIZE : flac_blocksize;
+				break;
+			case OPT_APODIZATION:
+				flac_apodization = optarg;
+				break;
+			case OPT_SERVE:
+				address = optarg;
+				break;
+			case OPT_WEIGHT:
+				synth.fist.weight = atoi(optarg);
+				synth.fist.weight = synth.fist.weight < MIN_WEIGHT || synth.fist.weight > MAX_WEIGHT ? DEFAULT_WEIGHT : synth.fist.weight;
+				break;
+			case OPT_JITTER:
+				synth.fist.jitter = atoi(optarg);
+				synth.fist.jitter = synth.fist.jitter < 0 || synth.fist.jitter > MAX_JITTER ? 0 : synth.fist.jitter;
+				break;
+			case OPT_DRIFT:
+				synth.fist.drift = atoi(optarg);
+				synth.fist.drift = synth.fist.drift < 0 || synth.fist.drift > MAX_DRIFT ? 0 : synth.fist.drift;
+				break;
+			case OPT_SEED:
+				synth.fist.seed = strtoul(optarg, NULL, 10);
+				break;
+			case OPT_NOISE:
+				noise = atoi(optarg);
+				noise = noise < 0 || noise > MAX_NOISE ? 0 : noise;
+				break;
+			case OPT_INCREMENTAL:
+				stash = optarg;
+				break;
+			case OPT_CACHE:
+				cache = atoi(optarg);
+				cache = cache < 0 || cache > MAX_CACHE_MB ? 0 : cache;
+				break;
+			case OPT_PROGRESS:
+				progress = atoi(optarg);
+				progress = progress < 0 ? -1 : progress;
+				break;
+			case OPT_STATS:
+				start_stats(optarg != NULL && strcmp(optarg, "json") == 0 ? STATS_JSON : STATS_TEXT);
+				break;
 			default:
 				show_usage(stderr, EXIT_FAILURE);
 				break;
@@ -666,46 +296,116 @@ int main(int argc, char *argv[]) {
 	argc -= optind;
 	argv += optind;
 
-	if (argc != 2) {
+	if (argc != 2 && !(batch && argc == 1) && !(realtime && argc <= 1) && !(address != NULL && argc == 0)) {
 		show_usage(stderr, EXIT_FAILURE);
 	}
 
-	input = fopen(argv[0], "r");
-	if (input == NULL) {
-		fprintf(stderr, "Could not open input file '%s'\n", argv[0]);
-		exit(EXIT_FAILURE);
+	synth.wpm = wpm;
+	synth.fwpm = fwpm;
+
+	/* reports are about one output, which batches, servers and playback don't have */
+	if (progress != -1 && !batch && !realtime && address == NULL) {
+		start_progress(progress, &synth);
+	}
+
+	/* requests bring their own settings, so the server sets up a synth per worker */
+	if (address != NULL) {
+		rc = serve(&synth, format == NULL ? &flac_sink : format, address, jobs, (size_t) cache * 1024 * 1024);
+		exit(rc == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
 	}
 
-	rc = init_space(wpm, fwpm);
+	/* likewise every voice of a mix has its own */
+	if (mix) {
+		rc = mix_voices(&synth, argv[0], format == NULL ? sink_type_for_path(argv[1], &flac_sink) : format, argv[1], noise);
+		exit(rc == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	init_space(&synth);
+
+	rc = init_tone(&synth);
 	if (rc == -1) {
-		fprintf(stderr, "Failed to initialize space\n");
+		fprintf(stderr, "Failed to initialize tones\n");
 		exit(EXIT_FAILURE);
 	}
 
-	rc = init_tone(wpm);
+	rc = init_glyphs(&synth, prerender);
 	if (rc == -1) {
-		fprintf(stderr, "Failed to initialize tones\n");
+		fprintf(stderr, "Failed to initialize glyphs\n");
 		exit(EXIT_FAILURE);
 	}
 
-	for (i = 0; (ch = getc(input)) != EOF; i++) {
-		if (i != 0) {
-			write_inter_character_space();
-		}
-		write_character(ch);
+	if (batch) {
+		rc = encode_batch(&synth, argc, argv, format == NULL ? &flac_sink : format, jobs);
+
+		exit_glyphs(&synth);
+		exit_tone(&synth);
+		exit_space(&synth);
+
+		exit(rc == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	if (realtime && argc == 0) {
+		play_keys(&synth, STDOUT_FILENO, STDIN_FILENO);
+
+		exit_glyphs(&synth);
+		exit_tone(&synth);
+		exit_space(&synth);
+
+		exit(EXIT_SUCCESS);
 	}
 
-	exit_tone();
-	exit_space();
+	if (!realtime) {
+		type = format == NULL ? sink_type_for_path(argv[1], &flac_sink) : format;
+	}
 
-	fclose(input);
+	/* a fist's plan runs from the start of the text, so it can't be split up */
+	parallel = !realtime && jobs > 1 && type == &flac_sink && !is_humanized(&synth);
+	incremental = !realtime && stash != NULL && type == &flac_sink && !is_humanized(&synth);
 
-	encode_result(argv[1]);
+	/* a pipe's length isn't known up front, so synthesize it as it's read */
+	if (!realtime && !parallel && !incremental && strcmp(argv[0], "-") == 0) {
+		init_sink(&sink, type, &result, &synth, argv[1], 0);
+		if (stream_text(&result, STDIN_FILENO) == -1) {
+			fprintf(stderr, "Could not read standard input\n");
+			exit(EXIT_FAILURE);
+		}
+		finish_sink(&sink, &result);
 
-	if (result != NULL) {
-		free(result);
-		result_len = 0;
+		exit_glyphs(&synth);
+		exit_tone(&synth);
+		exit_space(&synth);
+
+		exit(EXIT_SUCCESS);
 	}
 
+	rc = open_text(&input, argv[0]);
+	if (rc == -1) {
+		fprintf(stderr, "Could not open input file '%s'\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!realtime) {
+		expected = measure_text(&synth, input.bytes, input.len);
+		expect_progress(expected);
+	}
+
+	if (realtime) {
+		play_text(&synth, STDOUT_FILENO, input.bytes, input.len);
+	} else if (incremental) {
+		encode_incremental(&synth, &input, argv[1], stash, jobs);
+	} else if (parallel) {
+		encode_parallel(&synth, &input, argv[1], jobs);
+	} else {
+		init_sink(&sink, type, &result, &synth, argv[1], expected);
+		write_text(&result, input.bytes, input.len);
+		finish_sink(&sink, &result);
+	}
+
+	exit_glyphs(&synth);
+	exit_tone(&synth);
+	exit_space(&synth);
+
+	close_text(&input);
+
 	exit(EXIT_SUCCESS);
 }
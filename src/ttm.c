@@ -0,0 +1,228 @@
+ /*
+    ttm.c - libtexttomorse, text to morse code audio in process
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "normalize.h"
+#include "synth.h"
+#include "texttomorse.h"
+
+struct ttm {
+	struct synth synth;
+	struct output out;
+
+	/* fed and normalized but not yet rendered */
+	struct normalizer normalizer;
+	unsigned char *text;
+	size_t text_len;
+	size_t text_pos;
+	size_t text_cap;
+
+	/* whether a character has been rendered, so the next needs a space before it */
+	int started;
+
+	/* rendered but not yet read: at most one character and a ring */
+	int32_t *pcm;
+	size_t pcm_len;
+	size_t pcm_pos;
+	size_t pcm_cap;
+
+	/* memory ran out while rendering, and what was lost can't be read */
+	int failed;
+};
+
+/* flush callback: move the ring into the read queue */
+static void queue_output(struct output *out) {
+	struct ttm *ttm = (struct ttm *) out->data;
+	int32_t *p = NULL;
+	size_t cap = 0;
+
+	if (ttm->pcm_len + out->ring_len > ttm->pcm_cap) {
+		cap = ttm->pcm_cap == 0 ? RINGSIZE * 4 : ttm->pcm_cap;
+		while (ttm->pcm_len + out->ring_len > cap) {
+			cap *= 2;
+		}
+		p = (int32_t *) realloc(ttm->pcm, cap * sizeof(int32_t));
+		if (p == NULL) {
+			ttm->failed = 1;
+			return;
+		}
+		ttm->pcm = p;
+		ttm->pcm_cap = cap;
+	}
+
+	memcpy(ttm->pcm + ttm->pcm_len, out->pcm, out->ring_len * sizeof(int32_t));
+	ttm->pcm_len += out->ring_len;
+}
+
+void ttm_default_params(struct ttm_params *params) {
+	memset(params, '\0', sizeof(struct ttm_params));
+
+	params->wpm = DEFAULT_WPM;
+	params->fwpm = 0;
+	params->frequency = DEFAULT_FREQUENCY;
+	params->sample_rate = DEFAULT_SAMPLE_RATE;
+	params->bps = DEFAULT_BPS;
+	params->phase_continuous = 0;
+	params->weight = DEFAULT_WEIGHT;
+	params->jitter = 0;
+	params->drift = 0;
+	params->seed = DEFAULT_SEED;
+}
+
+static int valid_params(const struct ttm_params *params) {
+	return params->wpm >= 1 && params->wpm <= 100 &&
+		params->fwpm >= 0 && params->fwpm <= 100 &&
+		params->frequency >= 60 && params->frequency <= 3000 &&
+		params->sample_rate >= MIN_SAMPLE_RATE && params->sample_rate <= MAX_SAMPLE_RATE &&
+		valid_bps(params->bps) &&
+		params->weight >= MIN_WEIGHT && params->weight <= MAX_WEIGHT &&
+		params->jitter >= 0 && params->jitter <= MAX_JITTER &&
+		params->drift >= 0 && params->drift <= MAX_DRIFT;
+}
+
+struct ttm *ttm_open(const struct ttm_params *params) {
+	struct ttm *ttm = NULL;
+
+	if (!valid_params(params)) {
+		return NULL;
+	}
+
+	ttm = (struct ttm *) calloc(1, sizeof(struct ttm));
+	if (ttm == NULL) {
+		return NULL;
+	}
+
+	default_synth(&ttm->synth);
+	ttm->synth.wpm = params->wpm;
+	ttm->synth.fwpm = params->fwpm == 0 ? params->wpm : params->fwpm;
+	ttm->synth.frequency = params->frequency;
+	ttm->synth.sample_rate = params->sample_rate;
+	ttm->synth.bps = params->bps;
+	ttm->synth.phase_continuous = params->phase_continuous;
+	ttm->synth.fist.weight = params->weight;
+	ttm->synth.fist.jitter = params->jitter;
+	ttm->synth.fist.drift = params->drift;
+	ttm->synth.fist.seed = params->seed;
+
+	/* prerendered, so running out of memory is a NULL here rather than a failed read later */
+	init_space(&ttm->synth);
+	if (init_tone(&ttm->synth) == -1 || init_glyphs(&ttm->synth, 1) == -1) {
+		ttm_close(ttm);
+		return NULL;
+	}
+
+	init_output(&ttm->out, &ttm->synth, queue_output, ttm);
+	ttm->out.can_fail = 1;
+	init_normalizer(&ttm->normalizer);
+
+	return ttm;
+}
+
+/* final once the text is done, so nothing cut off at the end is held over */
+static int feed(struct ttm *ttm, const char *text, size_t len, int final) {
+	unsigned char *p = NULL;
+	size_t cap = 0;
+
+	/* drop what's already been rendered before growing */
+	if (ttm->text_pos > 0) {
+		memmove(ttm->text, ttm->text + ttm->text_pos, ttm->text_len - ttm->text_pos);
+		ttm->text_len -= ttm->text_pos;
+		ttm->text_pos = 0;
+	}
+
+	if (ttm->text_len + NORMALIZE_ROOM(len) > ttm->text_cap) {
+		cap = ttm->text_cap == 0 ? 256 : ttm->text_cap;
+		while (ttm->text_len + NORMALIZE_ROOM(len) > cap) {
+			cap *= 2;
+		}
+		p = (unsigned char *) realloc(ttm->text, cap);
+		if (p == NULL) {
+			return -1;
+		}
+		ttm->text = p;
+		ttm->text_cap = cap;
+	}
+
+	/* a character cut off at the end waits for the next feed */
+	ttm->text_len += normalize(&ttm->normalizer, ttm->text + ttm->text_len, (const unsigned char *) text, len, final);
+
+	return 0;
+}
+
+int ttm_feed(struct ttm *ttm, const char *text, size_t len) {
+	return feed(ttm, text, len, 0);
+}
+
+int ttm_finish(struct ttm *ttm) {
+	return feed(ttm, "", 0, 1);
+}
+
+size_t ttm_read(struct ttm *ttm, int32_t *pcm, size_t n) {
+	size_t done = 0;
+	size_t k = 0;
+
+	while (done < n && !ttm->failed) {
+		if (ttm->pcm_pos == ttm->pcm_len) {
+			ttm->pcm_pos = 0;
+			ttm->pcm_len = 0;
+
+			if (ttm->text_pos == ttm->text_len) {
+				break;
+			}
+
+			/* render one character (and the space before it) into the queue */
+			if (ttm->started) {
+				write_inter_character_space(&ttm->out);
+			}
+			write_character(&ttm->out, ttm->text[ttm->text_pos++]);
+			flush_output(&ttm->out);
+			ttm->failed |= ttm->out.failed;
+			ttm->started = 1;
+			continue;
+		}
+
+		k = ttm->pcm_len - ttm->pcm_pos < n - done ? ttm->pcm_len - ttm->pcm_pos : n - done;
+		memcpy(pcm + done, ttm->pcm + ttm->pcm_pos, k * sizeof(int32_t));
+		ttm->pcm_pos += k;
+		done += k;
+	}
+
+	return done;
+}
+
+int ttm_failed(const struct ttm *ttm) {
+	return ttm->failed;
+}
+
+void ttm_close(struct ttm *ttm) {
+	if (ttm == NULL) {
+		return;
+	}
+
+	exit_glyphs(&ttm->synth);
+	exit_tone(&ttm->synth);
+	exit_space(&ttm->synth);
+
+	free(ttm->text);
+	free(ttm->pcm);
+	free(ttm);
+}
@@ -0,0 +1,323 @@
+ /*
+    wav.c - uncompressed WAV and raw PCM output for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "progress.h"
+#include "sink.h"
+#include "synth.h"
+
+#define WAV_HEADER_LEN (44)
+
+/* the most data a header can give the length of, and what an unknown length is written as */
+#define WAV_MAX_DATA_LEN (UINT32_MAX - 37)
+
+/* segments gathered per writev() */
+#define PCM_IOV_MAX (1024)
+
+/* silence is written from here, a piece at a time */
+#define ZEROS_LEN (4096)
+static const int16_t zeros[ZEROS_LEN];
+
+/* both formats are little endian on disk, which is what the 16-bit caches hold on most hosts */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PCM_ZERO_COPY (1)
+#else
+#define PCM_ZERO_COPY (0)
+#endif
+
+struct pcm {
+	int fd;
+	int wav;
+	size_t bytes;
+
+	/* the length of data the header was first written with, SIZE_MAX if unknown */
+	size_t header_len;
+
+	/* written here instead of fd when it isn't NULL, starting at offset base */
+	struct buffer *buffer;
+	size_t base;
+
+	/* segments waiting for the next writev() */
+	struct iovec iov[PCM_IOV_MAX];
+	int iovcnt;
+
+	/* packed staging for other depths and hosts that can't write the caches directly */
+	unsigned char staged[RINGSIZE * 3];
+};
+
+static int write_iov(struct pcm *pcm) {
+	struct iovec *iov = pcm->iov;
+	int iovcnt = pcm->iovcnt;
+	ssize_t n = 0;
+
+	pcm->iovcnt = 0;
+
+	for (; pcm->buffer != NULL && iovcnt > 0; iov++, iovcnt--) {
+		if (append_buffer(pcm->buffer, iov->iov_base, iov->iov_len) == -1) {
+			errno = ENOMEM;
+			return -1;
+		}
+		pcm->bytes += iov->iov_len;
+	}
+
+	while (iovcnt > 0) {
+		n = writev(pcm->fd, iov, iovcnt);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		} else if (n == -1) {
+			return -1;
+		}
+		pcm->bytes += n;
+
+		/* drop whatever was written, which may end part way through a segment */
+		while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static void add_iov(struct pcm *pcm, const void *p, size_t len) {
+	if (pcm->iovcnt == PCM_IOV_MAX && write_iov(pcm) == -1) {
+		fprintf(stderr, "ERROR: writing output: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	pcm->iov[pcm->iovcnt].iov_base = (void *) p;
+	pcm->iov[pcm->iovcnt].iov_len = len;
+	pcm->iovcnt++;
+}
+
+/* the cached samples themselves go to writev(), nothing is copied */
+static void pcm_segment(struct output *out, const int16_t *data, size_t len) {
+	struct pcm *pcm = (struct pcm *) out->data;
+	size_t n = 0;
+
+	progress_synthesized(len);
+	progress_wrote(len, 0, len * sizeof(int16_t));
+
+	if (data != NULL) {
+		add_iov(pcm, data, len * sizeof(int16_t));
+		return;
+	}
+
+	for (; len > 0; len -= n) {
+		n = len < ZEROS_LEN ? len : ZEROS_LEN;
+		add_iov(pcm, zeros, n * sizeof(int16_t));
+	}
+}
+
+size_t pack_samples(unsigned char *dst, const int32_t *src, size_t n, int bps, int offset_binary) {
+	size_t width = bps / 8;
+	size_t i, j;
+
+	for (i = 0; i < n; i++) {
+		uint32_t v = offset_binary ? (uint32_t) src[i] + 0x80 : (uint32_t) src[i];
+
+		for (j = 0; j < width; j++) {
+			dst[i * width + j] = (v >> (8 * j)) & 0xff;
+		}
+	}
+
+	return n * width;
+}
+
+static void pcm_flush(struct output *out) {
+	struct pcm *pcm = (struct pcm *) out->data;
+	size_t len = 0;
+
+	/* 8-bit WAV is unsigned, everything else is signed */
+	len = pack_samples(pcm->staged, out->pcm, out->ring_len, out->synth->bps, pcm->wav && out->synth->bps == 8);
+
+	add_iov(pcm, pcm->staged, len);
+	if (write_iov(pcm) == -1) {
+		fprintf(stderr, "ERROR: writing output: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	progress_synthesized(out->ring_len);
+	progress_wrote(out->ring_len, 0, len);
+}
+
+static void put_le(unsigned char *p, uint32_t v, int len) {
+	int i;
+
+	for (i = 0; i < len; i++) {
+		p[i] = (v >> (8 * i)) & 0xff;
+	}
+}
+
+/*
+ * canonical 44 byte PCM header; a length too big for it (or unknown) is
+ * saturated, to an even one so the RIFF size doesn't wrap. an odd length
+ * of data is followed by a pad byte, which the RIFF chunk counts and the
+ * data chunk doesn't.
+ */
+static void put_wav_header(unsigned char *p, const struct synth *synth, size_t bytes) {
+	uint32_t len = bytes > WAV_MAX_DATA_LEN ? WAV_MAX_DATA_LEN : bytes;
+
+	memcpy(p, "RIFF", 4);
+	put_le(p + 4, 36 + len + (len & 1), 4);
+	memcpy(p + 8, "WAVEfmt ", 8);
+	put_le(p + 16, 16, 4);
+	put_le(p + 20, 1, 2);
+	put_le(p + 22, channels, 2);
+	put_le(p + 24, synth->sample_rate, 4);
+	put_le(p + 28, synth->sample_rate * channels * (synth->bps / 8), 4);
+	put_le(p + 32, channels * (synth->bps / 8), 2);
+	put_le(p + 34, synth->bps, 2);
+	memcpy(p + 36, "data", 4);
+	put_le(p + 40, len, 4);
+}
+
+static void *create_pcm(void) {
+	return calloc(1, sizeof(struct pcm));
+}
+
+static void destroy_pcm(void *state) {
+	free(state);
+}
+
+/* to filepath, or to buffer when it isn't NULL */
+static int open_pcm(struct output *out, struct synth *synth, struct pcm *pcm, char *filepath, struct buffer *buffer, size_t expected_samples) {
+	unsigned char header[WAV_HEADER_LEN];
+
+	if (buffer != NULL) {
+		pcm->fd = -1;
+	} else if (strcmp(filepath, "-") == 0) {
+		pcm->fd = STDOUT_FILENO;
+	} else {
+		pcm->fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (pcm->fd == -1) {
+			fprintf(stderr, "ERROR: could not open output file '%s'\n", filepath);
+			return -1;
+		}
+	}
+	pcm->buffer = buffer;
+	pcm->base = buffer != NULL ? buffer->len : 0;
+
+	/* the length is known, so the whole answer is one allocation */
+	if (buffer != NULL && expected_samples > 0 &&
+			reserve_buffer(buffer, (pcm->wav ? WAV_HEADER_LEN : 0) + expected_samples * channels * (synth->bps / 8)) == -1) {
+		return -1;
+	}
+	pcm->bytes = 0;
+	pcm->iovcnt = 0;
+
+	/* an unknown length is written as the largest there is, which players stream to EOF */
+	pcm->header_len = expected_samples == 0 ? SIZE_MAX : expected_samples * channels * (synth->bps / 8);
+	if (pcm->wav) {
+		put_wav_header(header, synth, pcm->header_len);
+		add_iov(pcm, header, sizeof(header));
+		if (write_iov(pcm) == -1) {
+			fprintf(stderr, "ERROR: writing output: %s\n", strerror(errno));
+			if (pcm->fd != STDOUT_FILENO && pcm->fd != -1) {
+				close(pcm->fd);
+			}
+			return -1;
+		}
+	}
+
+	init_output(out, synth, pcm_flush, pcm);
+	if (PCM_ZERO_COPY && synth->bps == 16) {
+		out->segment = pcm_segment;
+	}
+
+	return 0;
+}
+
+static int open_wav(struct output *out, struct synth *synth, void *state, char *filepath, size_t expected_samples) {
+	((struct pcm *) state)->wav = 1;
+	return open_pcm(out, synth, (struct pcm *) state, filepath, NULL, expected_samples);
+}
+
+static int open_wav_buffer(struct output *out, struct synth *synth, void *state, struct buffer *buffer, size_t expected_samples) {
+	((struct pcm *) state)->wav = 1;
+	return open_pcm(out, synth, (struct pcm *) state, NULL, buffer, expected_samples);
+}
+
+static int open_raw(struct output *out, struct synth *synth, void *state, char *filepath, size_t expected_samples) {
+	((struct pcm *) state)->wav = 0;
+	return open_pcm(out, synth, (struct pcm *) state, filepath, NULL, expected_samples);
+}
+
+static int open_raw_buffer(struct output *out, struct synth *synth, void *state, struct buffer *buffer, size_t expected_samples) {
+	((struct pcm *) state)->wav = 0;
+	return open_pcm(out, synth, (struct pcm *) state, NULL, buffer, expected_samples);
+}
+
+static int close_pcm(struct output *out) {
+	struct pcm *pcm = (struct pcm *) out->data;
+	unsigned char header[WAV_HEADER_LEN];
+	size_t data_len = 0;
+	int rc = 0;
+
+	flush_output(out);
+	rc = write_iov(pcm);
+
+	/*
+	 * the pad byte only goes where the header will say how long the data
+	 * is; a stream read to EOF would play it as one more sample
+	 */
+	data_len = pcm->bytes - (pcm->wav ? WAV_HEADER_LEN : 0);
+	if (rc == 0 && pcm->wav && data_len % 2 == 1 &&
+			(pcm->buffer != NULL || pcm->fd != STDOUT_FILENO || data_len == pcm->header_len)) {
+		add_iov(pcm, zeros, 1);
+		rc = write_iov(pcm);
+	}
+
+	/* now the real length is known, put it in the header if the file can be rewritten */
+	if (rc == 0 && pcm->wav && pcm->buffer != NULL) {
+		put_wav_header(pcm->buffer->data + pcm->base, out->synth, data_len);
+	} else if (rc == 0 && pcm->wav && pcm->fd != STDOUT_FILENO) {
+		put_wav_header(header, out->synth, data_len);
+		rc = pwrite(pcm->fd, header, sizeof(header), 0) == sizeof(header) ? 0 : -1;
+	}
+
+	if (pcm->fd != STDOUT_FILENO && pcm->fd != -1 && close(pcm->fd) == -1) {
+		rc = -1;
+	}
+	pcm->fd = -1;
+
+	return rc;
+}
+
+const struct sink_type wav_sink = {
+	"wav", ".wav", create_pcm, destroy_pcm, open_wav, open_wav_buffer, close_pcm
+};
+
+const struct sink_type raw_sink = {
+	"raw", ".raw", create_pcm, destroy_pcm, open_raw, open_raw_buffer, close_pcm
+};
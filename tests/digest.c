@@ -0,0 +1,271 @@
+ /*
+    digest.c - sample count and digest of the PCM in a text-to-morse output
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <FLAC/stream_decoder.h>
+
+/* the data length of a WAV header written before the length was known */
+#define WAV_UNKNOWN_LEN (UINT32_MAX - 37)
+
+/*
+ * every sample is added to the digest as its signed value, whatever the
+ * container and depth, so the same audio has the same digest in FLAC,
+ * WAV and raw PCM.
+ */
+struct digest {
+	uint64_t samples;
+	uint64_t hash;
+
+	/* from STREAMINFO, 0 if the encoder didn't know it */
+	uint64_t total_samples;
+};
+
+static void init_digest(struct digest *d) {
+	d->samples = 0;
+	d->hash = 0xcbf29ce484222325ULL;
+	d->total_samples = 0;
+}
+
+static void add_sample(struct digest *d, int32_t sample) {
+	d->hash = (d->hash ^ (uint32_t) sample) * 0x100000001b3ULL;
+	d->samples++;
+}
+
+static void fail(const char *path, const char *reason) {
+	fprintf(stderr, "ERROR: %s: %s\n", path, reason);
+	exit(EXIT_FAILURE);
+}
+
+static unsigned char *read_file(const char *path, size_t *len) {
+	unsigned char *data = NULL;
+	FILE *f = NULL;
+	long n = 0;
+
+	f = fopen(path, "rb");
+	if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (n = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		fail(path, "could not open");
+	}
+
+	data = (unsigned char *) malloc(n + 1);
+	if (data == NULL) {
+		fprintf(stderr, "malloc failed :(\n");
+		exit(EXIT_FAILURE);
+	}
+
+	*len = fread(data, 1, n, f);
+	if (*len != (size_t) n) {
+		fail(path, "could not read");
+	}
+	fclose(f);
+
+	return data;
+}
+
+static uint32_t get_le(const unsigned char *p, int len) {
+	uint32_t v = 0;
+	int i;
+
+	for (i = len - 1; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+
+	return v;
+}
+
+/* little endian samples of bps bits, 8-bit ones unsigned as in WAV */
+static void digest_pcm(struct digest *d, const unsigned char *p, size_t len, int bps, int offset_binary) {
+	size_t width = bps / 8;
+	uint32_t v = 0;
+	size_t i;
+
+	for (i = 0; i + width <= len; i += width) {
+		v = get_le(p + i, width);
+		if (offset_binary) {
+			add_sample(d, (int32_t) v - 0x80);
+		} else {
+			/* sign extend from the top bit of the sample */
+			add_sample(d, (int32_t) (v << (32 - bps)) >> (32 - bps));
+		}
+	}
+}
+
+/*
+ * a canonical file: every chunk padded to even and the RIFF size exact.
+ * one streamed without knowing its length has the largest sizes there
+ * are, and its data runs to the end of the file.
+ */
+static void digest_wav(struct digest *d, const char *path, const unsigned char *data, size_t len) {
+	const unsigned char *data_chunk = NULL;
+	uint32_t chunk_len = 0;
+	uint32_t data_len = 0;
+	size_t pos = 12;
+	int streamed = 0;
+	int bps = 0;
+
+	if (len < 12 || memcmp(data + 8, "WAVE", 4) != 0) {
+		fail(path, "not a WAVE file");
+	}
+
+	streamed = get_le(data + 4, 4) == 36 + WAV_UNKNOWN_LEN;
+	if (!streamed && get_le(data + 4, 4) != len - 8) {
+		fail(path, "RIFF size isn't the length of the file");
+	}
+
+	while (pos + 8 <= len) {
+		chunk_len = get_le(data + pos + 4, 4);
+		if (streamed && memcmp(data + pos, "data", 4) == 0 && chunk_len == WAV_UNKNOWN_LEN) {
+			/* the rest of the file, without a pad byte that would read as a sample */
+			data_chunk = data + pos + 8;
+			data_len = len - pos - 8;
+			pos = len;
+			break;
+		} else if (pos + 8 + chunk_len + (chunk_len & 1) > len) {
+			fail(path, "chunk runs past the end of the file");
+		}
+
+		if (memcmp(data + pos, "fmt ", 4) == 0 && chunk_len >= 16) {
+			if (get_le(data + pos + 8, 2) != 1 || get_le(data + pos + 10, 2) != 1) {
+				fail(path, "not mono PCM");
+			}
+			bps = get_le(data + pos + 22, 2);
+		} else if (memcmp(data + pos, "data", 4) == 0) {
+			data_chunk = data + pos + 8;
+			data_len = chunk_len;
+		}
+		pos += 8 + chunk_len + (chunk_len & 1);
+	}
+
+	if (pos != len) {
+		fail(path, "bytes left over after the last chunk");
+	} else if (data_chunk == NULL || (bps != 8 && bps != 16 && bps != 24) || data_len % (bps / 8) != 0) {
+		fail(path, "no whole samples of 8, 16 or 24 bits");
+	}
+
+	digest_pcm(d, data_chunk, data_len, bps, bps == 8);
+}
+
+static FLAC__StreamDecoderWriteStatus write_frame(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data) {
+	struct digest *d = (struct digest *) client_data;
+	uint32_t i;
+
+	(void) decoder;
+
+	if (frame->header.channels != 1) {
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+	}
+
+	for (i = 0; i < frame->header.blocksize; i++) {
+		add_sample(d, buffer[0][i]);
+	}
+
+	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void read_metadata(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data) {
+	struct digest *d = (struct digest *) client_data;
+
+	(void) decoder;
+
+	if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+		d->total_samples = metadata->data.stream_info.total_samples;
+	}
+}
+
+static void decode_error(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data) {
+	(void) decoder;
+	(void) client_data;
+
+	fprintf(stderr, "ERROR: decoding: %s\n", FLAC__StreamDecoderErrorStatusString[status]);
+	exit(EXIT_FAILURE);
+}
+
+/* decoded with the MD5 check, which fails if the samples aren't the ones encoded */
+static void digest_flac(struct digest *d, const char *path) {
+	FLAC__StreamDecoder *decoder = NULL;
+
+	decoder = FLAC__stream_decoder_new();
+	if (decoder == NULL) {
+		fprintf(stderr, "ERROR: allocating decoder\n");
+		exit(EXIT_FAILURE);
+	}
+
+	FLAC__stream_decoder_set_md5_checking(decoder, true);
+	if (FLAC__stream_decoder_init_file(decoder, path, write_frame, read_metadata, decode_error, d) != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+		fail(path, "could not open");
+	} else if (!FLAC__stream_decoder_process_until_end_of_stream(decoder)) {
+		fail(path, "could not decode");
+	} else if (!FLAC__stream_decoder_finish(decoder)) {
+		fail(path, "MD5 doesn't match the samples");
+	}
+	FLAC__stream_decoder_delete(decoder);
+
+	if (d->total_samples != 0 && d->total_samples != d->samples) {
+		fail(path, "STREAMINFO length isn't the number of samples");
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	struct digest d;
+	unsigned char *data = NULL;
+	size_t len = 0;
+	int bps = 16;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "d:h")) != -1) {
+		switch (ch) {
+			case 'd':
+				bps = atoi(optarg);
+				bps = bps == 8 || bps == 24 ? bps : 16;
+				break;
+			default:
+				fprintf(stderr, "usage: text-to-morse-digest [-d BITS] FILE\n");
+				exit(ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (optind + 1 != argc) {
+		fprintf(stderr, "usage: text-to-morse-digest [-d BITS] FILE\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* FLAC and WAV by their magic, anything else is raw PCM of -d BITS */
+	init_digest(&d);
+	data = read_file(argv[optind], &len);
+	if (len >= 4 && memcmp(data, "fLaC", 4) == 0) {
+		digest_flac(&d, argv[optind]);
+	} else if (len >= 4 && memcmp(data, "RIFF", 4) == 0) {
+		digest_wav(&d, argv[optind], data, len);
+	} else if (len % (bps / 8) != 0) {
+		fail(argv[optind], "not a whole number of samples");
+	} else {
+		digest_pcm(&d, data, len, bps, 0);
+	}
+	free(data);
+
+	printf("%llu %016llx\n", (unsigned long long) d.samples, (unsigned long long) d.hash);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,60 @@
+# golden.cmake - render a text and compare the decoded PCM to a golden digest
+# Copyright 2022, 2023, 2024  Thomas Cort
+#
+# Copying and distribution of this file, with or without modification, are
+# permitted in any medium without royalty, provided the copyright notice and
+# this notice are preserved. This file is offered as-is, without any warranty.
+#
+# cmake -DTEXT_TO_MORSE=EXE -DDIGEST=EXE -DINPUT=TXT -DOUTPUT=FILE
+#       -DEXPECTED="SAMPLES DIGEST" [-DARGS="OPTIONS"]
+#       [-DSTASH=FILE -DDRAFT=TXT] [-DPIPE=ON] -P golden.cmake
+#
+# with STASH, DRAFT is rendered into a new stash first, so INPUT reuses the
+# words the two have in common. with PIPE, INPUT is read from standard input
+# and OUTPUT written to standard output, so its length isn't known up front.
+
+separate_arguments(args UNIX_COMMAND "${ARGS}")
+file(REMOVE "${OUTPUT}")
+
+if(DEFINED STASH)
+    file(REMOVE "${STASH}")
+    list(APPEND args "--incremental=${STASH}")
+    execute_process(
+        COMMAND "${TEXT_TO_MORSE}" ${args} "${DRAFT}" "${OUTPUT}"
+        RESULT_VARIABLE rc
+    )
+    if(NOT rc EQUAL 0)
+        message(FATAL_ERROR "rendering ${DRAFT} failed: ${rc}")
+    endif()
+endif()
+
+if(PIPE)
+    # through a pipe, since standard input that's a file is mapped like one
+    file(READ "${INPUT}" text)
+    execute_process(
+        COMMAND "${CMAKE_COMMAND}" -E echo_append "${text}"
+        COMMAND "${TEXT_TO_MORSE}" ${args} - -
+        OUTPUT_FILE "${OUTPUT}"
+        RESULT_VARIABLE rc
+    )
+else()
+    execute_process(
+        COMMAND "${TEXT_TO_MORSE}" ${args} "${INPUT}" "${OUTPUT}"
+        RESULT_VARIABLE rc
+    )
+endif()
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "rendering ${INPUT} failed: ${rc}")
+endif()
+
+execute_process(
+    COMMAND "${DIGEST}" "${OUTPUT}"
+    RESULT_VARIABLE rc
+    OUTPUT_VARIABLE digest
+    OUTPUT_STRIP_TRAILING_WHITESPACE
+)
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "${OUTPUT} is not a valid output: ${rc}")
+elseif(NOT digest STREQUAL EXPECTED)
+    message(FATAL_ERROR "${OUTPUT} is '${digest}', expected '${EXPECTED}'")
+endif()
@@ -0,0 +1,90 @@
+ /*
+    mkalphabet - generates the packed morse code table for text-to-morse
+    Copyright (C) 2022, 2023, 2024  Thomas Cort
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, see <https://www.gnu.org/licenses/>.
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "morse.h"
+
+static const char *alphabet[] = {
+#include "alphabet.inc"
+};
+
+int main(int argc, char *argv[]) {
+
+	FILE *out = NULL;
+	const char *s = NULL;
+	unsigned code = 0;
+	unsigned dahs = 0;
+	size_t len = 0;
+	size_t i = 0;
+	int c = 0;
+
+	if (argc != 2 || sizeof(alphabet) / sizeof(alphabet[0]) != 256) {
+		fprintf(stderr, "usage: mkalphabet OUTPUT.C\n");
+		exit(EXIT_FAILURE);
+	}
+
+	out = fopen(argv[1], "w");
+	if (out == NULL) {
+		fprintf(stderr, "Could not open output file '%s'\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(out, "/* generated by mkalphabet from alphabet.inc, do not edit */\n\n");
+	fprintf(out, "#include \"morse.h\"\n\n");
+	fprintf(out, "const struct morse morse_table[256] = {\n");
+
+	for (c = 0; c < 256; c++) {
+		s = alphabet[c];
+		len = strlen(s);
+
+		if (len > 0 && strspn(s, " ") == len) {
+			fprintf(out, "\t{ 0x0000, 0, 0, 1 }, /* %d */\n", c);
+			continue;
+		}
+
+		if (strspn(s, ".-") != len || len > MORSE_MAX_ELEMENTS) {
+			fprintf(stderr, "alphabet.inc: bad code \"%s\" for %d\n", s, c);
+			exit(EXIT_FAILURE);
+		}
+
+		code = 0;
+		dahs = 0;
+		for (i = 0; i < len; i++) {
+			if (s[i] == '-') {
+				code |= 1u << i;
+				dahs++;
+			}
+		}
+
+		fprintf(out, "\t{ 0x%04x, %lu, %u, 0 }, /* %d */\n", code, (unsigned long) len, dahs, c);
+	}
+
+	fprintf(out, "};\n");
+
+	if (fclose(out) != 0) {
+		fprintf(stderr, "Could not write output file '%s'\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	return EXIT_SUCCESS;
+}